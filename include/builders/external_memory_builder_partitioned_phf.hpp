@@ -7,9 +7,11 @@
 
 namespace pthash {
 
-template <typename Hasher>
+template <typename Hasher, typename RangeReducer = fastmod_reducer>
 struct external_memory_builder_partitioned_phf {
     typedef Hasher hasher_type;
+    typedef RangeReducer range_reducer_type;
+    typedef internal_memory_builder_single_phf<Hasher, RangeReducer> partition_builder_type;
     typedef typename hasher_type::hash_type hash_type;
 
     template <typename Iterator>
@@ -21,6 +23,10 @@ struct external_memory_builder_partitioned_phf {
         if (config.num_partitions == 0) {
             throw std::invalid_argument("number of partitions must be > 0");
         }
+        if (config.max_pilot > constants::unlimited_pilot) {
+            throw std::invalid_argument("max_pilot must be <= " +
+                                        std::to_string(constants::unlimited_pilot));
+        }
 
         auto start = clock_type::now();
 
@@ -53,28 +59,50 @@ struct external_memory_builder_partitioned_phf {
 
         for (uint64_t id = 0; id != num_partitions; ++id) {
             partitions.emplace_back(config.tmp_dir, id);
-            partitions.back().reserve(1.5 * average_partition_size);
         }
 
-        size_t bytes = num_partitions * sizeof(meta_partition);
+        /*
+            Every hashing thread appends the hashes to its own buffer of each partition and,
+            when its share of the RAM is used up, writes all its buffers to the partition
+            files: only the writes to the same file are serialized.
+        */
+        const uint64_t num_threads = num_hashing_threads<Iterator>(num_keys, config.num_threads);
+        const uint64_t bytes_per_thread = num_partitions * sizeof(std::vector<hash_type>);
+        size_t bytes = num_partitions * (sizeof(meta_partition) + sizeof(std::mutex)) +
+                       num_threads * bytes_per_thread;
         if (bytes >= config.ram) throw std::runtime_error("not enough RAM available");
+        const uint64_t ram_per_thread = (config.ram - bytes) / num_threads + bytes_per_thread;
 
-        progress_logger logger(num_keys, " == partitioned ", " keys", config.verbose_output);
-        for (uint64_t i = 0; i != num_keys; ++i, ++keys) {
-            auto const& key = *keys;
-            auto hash = hasher_type::hash(key, m_seed);
-            auto b = m_bucketer.bucket(hash.mix());
-            partitions[b].push_back(hash);
-            bytes += sizeof(hash_type);
-            if (bytes >= config.ram) {
-                for (auto& partition : partitions) partition.flush();
-                bytes = num_partitions * sizeof(meta_partition);
+        std::vector<partition_buffers> buffers(num_threads);
+        for (auto& b : buffers) b.init(num_partitions, 1.5 * average_partition_size / num_threads);
+        std::vector<std::mutex> files_mutexes(num_partitions);
+        auto flush = [&](partition_buffers& b) {
+            for (uint64_t i = 0; i != num_partitions; ++i) {
+                if (b.hashes[i].empty()) continue;
+                std::lock_guard<std::mutex> lock(files_mutexes[i]);
+                partitions[i].append(b.hashes[i]);
             }
-            logger.log();
-        }
+            b.bytes = bytes_per_thread;
+        };
+
+        progress_logger logger(num_keys, " == partitioned ", " keys", config.verbose_output);
+        std::mutex logger_mutex;  // only the progress logger is shared by the threads
+        hash_keys<hasher_type>(keys, num_keys, m_seed, config.num_threads, config.pool,
+                               [&](uint64_t tid, hash_type const* hashes, uint64_t n) {
+                                   auto& b = buffers[tid];
+                                   for (uint64_t i = 0; i != n; ++i) {
+                                       auto p = m_bucketer.bucket(hashes[i].mix());
+                                       b.hashes[p].push_back(hashes[i]);
+                                       b.bytes += sizeof(hash_type);
+                                       if (b.bytes >= ram_per_thread) flush(b);
+                                   }
+                                   std::lock_guard<std::mutex> lock(logger_mutex);
+                                   logger.log(n);
+                               });
         logger.finalize();
 
-        for (auto& partition : partitions) partition.release();
+        for (auto& b : buffers) flush(b);
+        std::vector<partition_buffers>().swap(buffers);
 
         bool failure = false;
         for (uint64_t i = 0, cumulative_size = 0; i != num_partitions; ++i) {
@@ -122,14 +150,15 @@ struct external_memory_builder_partitioned_phf {
                     std::cout << "processing " << in_memory_partitions.size() << "/"
                               << num_partitions << " partitions..." << std::endl;
                 }
-                std::vector<internal_memory_builder_single_phf<hasher_type>> in_memory_builders(
-                    in_memory_partitions.size());
+                std::vector<partition_builder_type> in_memory_builders(in_memory_partitions.size());
                 partition_config.num_partitions = in_memory_partitions.size();
-                auto t = internal_memory_builder_partitioned_phf<hasher_type>::build_partitions(
-                    in_memory_partitions.begin(), in_memory_builders.begin(), partition_config,
-                    config.num_threads);
+                auto t =
+                    internal_memory_builder_partitioned_phf<hasher_type, RangeReducer>::
+                        build_partitions(in_memory_partitions.begin(), in_memory_builders.begin(),
+                                         partition_config, config.num_threads);
                 timings.mapping_ordering_seconds += t.mapping_ordering_seconds;
                 timings.searching_seconds += t.searching_seconds;
+                timings.searching_trials += t.searching_trials;
                 in_memory_partitions.clear();
                 bytes = num_partitions * sizeof(meta_partition);
 
@@ -140,7 +169,7 @@ struct external_memory_builder_partitioned_phf {
                 uint64_t id = i - partition_config.num_partitions;
                 for (auto& builder : in_memory_builders) {
                     m_builders.save(builder, id);
-                    internal_memory_builder_single_phf<hasher_type>().swap(builder);
+                    partition_builder_type().swap(builder);
                     ++id;
                 }
                 timings.partitioning_seconds += seconds(clock_type::now() - start);
@@ -149,8 +178,9 @@ struct external_memory_builder_partitioned_phf {
 
             for (; i != num_partitions; ++i) {
                 uint64_t size = partitions[i].size();
-                uint64_t partition_bytes = internal_memory_builder_single_phf<
-                    hasher_type>::estimate_num_bytes_for_construction(size, partition_config);
+                uint64_t partition_bytes =
+                    partition_builder_type::estimate_num_bytes_for_construction(size,
+                                                                                partition_config);
                 if (bytes + partition_bytes >= config.ram) {
                     timings.partitioning_seconds += seconds(clock_type::now() - start);
                     build_partitions();
@@ -171,7 +201,7 @@ struct external_memory_builder_partitioned_phf {
             std::vector<std::vector<hash_type>>().swap(in_memory_partitions);
 
         } else {  // sequential
-            internal_memory_builder_single_phf<hasher_type> b;
+            partition_builder_type b;
             for (uint64_t i = 0; i != num_partitions; ++i) {
                 if (config.verbose_output) {
                     std::cout << "processing partition " << i << "/" << num_partitions
@@ -179,7 +209,8 @@ struct external_memory_builder_partitioned_phf {
                 }
                 mm::file_source<hash_type> partition(partitions[i].filename(),
                                                      mm::advice::sequential);
-                auto t = b.build_from_hashes(partition.data(), partition.size(), partition_config);
+                auto t = internal_memory_builder_partitioned_phf<hasher_type, RangeReducer>::
+                    build_partition(partition.data(), partition.size(), b, partition_config);
                 partition.close();
                 start = clock_type::now();
                 std::remove(partitions[i].filename().c_str());
@@ -187,6 +218,7 @@ struct external_memory_builder_partitioned_phf {
                 timings.partitioning_seconds += seconds(clock_type::now() - start);
                 timings.mapping_ordering_seconds += t.mapping_ordering_seconds;
                 timings.searching_seconds += t.searching_seconds;
+                timings.searching_trials += t.searching_trials;
             }
         }
 
@@ -209,7 +241,7 @@ struct external_memory_builder_partitioned_phf {
         return m_num_partitions;
     }
 
-    uniform_bucketer bucketer() const {
+    uniform_bucketer<RangeReducer> bucketer() const {
         return m_bucketer;
     }
 
@@ -267,8 +299,7 @@ private:
     };
 
 public:
-    builders_files_manager<internal_memory_builder_single_phf<hasher_type>> const& builders()
-        const {
+    builders_files_manager<partition_builder_type> const& builders() const {
         return m_builders;
     }
 
@@ -277,40 +308,27 @@ private:
     uint64_t m_num_keys;
     uint64_t m_table_size;
     uint64_t m_num_partitions;
-    uniform_bucketer m_bucketer;
+    uniform_bucketer<RangeReducer> m_bucketer;
     std::vector<uint64_t> m_offsets;
-    builders_files_manager<internal_memory_builder_single_phf<hasher_type>> m_builders;
+    builders_files_manager<partition_builder_type> m_builders;
 
     struct meta_partition {
         meta_partition(std::string const& dir_name, uint64_t id)
             : m_filename(dir_name + "/pthash.temp." + std::to_string(id)), m_size(0) {}
 
-        void push_back(hash_type hash) {
-            m_hashes.push_back(hash);
-        }
-
         std::string const& filename() const {
             return m_filename;
         }
 
-        void flush() {
-            if (m_hashes.empty()) return;
-            m_size += m_hashes.size();
+        /* Append the hashes to the file and clear them. */
+        void append(std::vector<hash_type>& hashes) {
+            m_size += hashes.size();
             std::ofstream out(m_filename.c_str(), std::ofstream::binary | std::ofstream::app);
             if (!out.is_open()) throw std::runtime_error("cannot open file");
-            out.write(reinterpret_cast<char const*>(m_hashes.data()),
-                      m_hashes.size() * sizeof(hash_type));
+            out.write(reinterpret_cast<char const*>(hashes.data()),
+                      hashes.size() * sizeof(hash_type));
             out.close();
-            m_hashes.clear();
-        }
-
-        void reserve(uint64_t n) {
-            m_hashes.reserve(n);
-        }
-
-        void release() {
-            flush();
-            std::vector<hash_type>().swap(m_hashes);
+            hashes.clear();
         }
 
         uint64_t size() const {
@@ -319,9 +337,20 @@ private:
 
     private:
         std::string m_filename;
-        std::vector<hash_type> m_hashes;
         uint64_t m_size;
     };
+
+    /* The hashes of each partition that one thread has not yet appended to the file. */
+    struct partition_buffers {
+        void init(uint64_t num_partitions, uint64_t capacity) {
+            hashes.resize(num_partitions);
+            for (auto& h : hashes) h.reserve(capacity);
+            bytes = num_partitions * sizeof(std::vector<hash_type>);
+        }
+
+        std::vector<std::vector<hash_type>> hashes;
+        uint64_t bytes;
+    };
 };
 
 }  // namespace pthash
\ No newline at end of file
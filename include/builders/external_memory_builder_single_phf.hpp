@@ -9,11 +9,16 @@
 
 namespace pthash {
 
-template <typename Hasher>
+template <typename Hasher, typename RangeReducer = fastmod_reducer>
 struct external_memory_builder_single_phf {
     typedef Hasher hasher_type;
+    typedef RangeReducer range_reducer_type;
+    typedef typename hasher_type::hash_type hash_type;
 
-    external_memory_builder_single_phf() : m_pilots_filename(""), m_free_slots_filename("") {}
+    external_memory_builder_single_phf()
+        : m_max_pilot(constants::unlimited_pilot)
+        , m_pilots_filename("")
+        , m_free_slots_filename("") {}
     // non construction-copyable
     external_memory_builder_single_phf(external_memory_builder_single_phf const&) = delete;
     // non copyable
@@ -36,6 +41,10 @@ struct external_memory_builder_single_phf {
         if (config.alpha == 0 or config.alpha > 1.0) {
             throw std::invalid_argument("load factor must be > 0 and <= 1.0");
         }
+        if (config.max_pilot > constants::unlimited_pilot) {
+            throw std::invalid_argument("max_pilot must be <= " +
+                                        std::to_string(constants::unlimited_pilot));
+        }
 
         build_timings time;
         uint64_t table_size = static_cast<double>(num_keys) / config.alpha;
@@ -56,6 +65,7 @@ struct external_memory_builder_single_phf {
         m_table_size = table_size;
         m_num_buckets = num_buckets;
         m_seed = config.seed == constants::invalid_seed ? random_value() : config.seed;
+        m_max_pilot = config.max_pilot;
         m_bucketer.init(num_buckets);
 
         uint64_t ram = config.ram;
@@ -140,8 +150,14 @@ struct external_memory_builder_single_phf {
                 auto pilots =
                     tfm.get_multifile_pairs_writer(num_non_empty_buckets, ram_for_pilots, 1, 0);
 
-                search(m_num_keys, m_num_buckets, num_non_empty_buckets, m_seed, config,
-                       buckets_iterator, taken, pilots);
+                m_bumped_keys.clear();
+                time.searching_trials =
+                    search<RangeReducer>(m_num_keys, m_num_buckets, num_non_empty_buckets, m_seed,
+                                         config, buckets_iterator, taken, pilots, m_bumped_keys);
+                place_bumped_keys(m_bumped_keys, taken);
+                if (config.verbose_output) {
+                    std::cout << " == bumped keys = " << m_bumped_keys.size() << std::endl;
+                }
 
                 pilots.flush();
                 buckets_iterator.close();
@@ -195,7 +211,7 @@ struct external_memory_builder_single_phf {
         return m_table_size;
     }
 
-    skew_bucketer bucketer() const {
+    skew_bucketer<RangeReducer> bucketer() const {
         return m_bucketer;
     }
 
@@ -207,14 +223,25 @@ struct external_memory_builder_single_phf {
         return mm::file_source<uint64_t>(m_free_slots_filename);
     }
 
+    uint64_t max_pilot() const {
+        return m_max_pilot;
+    }
+
+    /* The keys of the bumped buckets, sorted by bucket and payload. */
+    std::vector<bumped_key> const& bumped_keys() const {
+        return m_bumped_keys;
+    }
+
 private:
     uint64_t m_seed;
     uint64_t m_num_keys;
     uint64_t m_table_size;
     uint64_t m_num_buckets;
-    skew_bucketer m_bucketer;
+    uint64_t m_max_pilot;
+    skew_bucketer<RangeReducer> m_bucketer;
     std::string m_pilots_filename;
     std::string m_free_slots_filename;
+    std::vector<bumped_key> m_bumped_keys;  // few: kept in internal memory
 
     template <typename T>
     struct buffer_t {
@@ -253,6 +280,14 @@ private:
             if (!m_out.is_open()) throw std::runtime_error("cannot open binary file in write mode");
         }
 
+        /* Overwrite an existing file starting from the given byte offset. */
+        buffered_file_t(std::string const& filename, uint64_t ram, uint64_t offset)
+            : buffer_t<T>(ram) {
+            m_out.open(filename, std::ofstream::in | std::ofstream::out | std::ofstream::binary);
+            if (!m_out.is_open()) throw std::runtime_error("cannot open binary file in write mode");
+            m_out.seekp(offset);
+        }
+
         void close() {
             buffer_t<T>::flush();
             m_out.close();
@@ -314,6 +349,8 @@ private:
 
     struct pairs_merger_t {
         pairs_merger_t(std::string const& filename, uint64_t ram) : m_buffer(filename, ram) {}
+        pairs_merger_t(std::string const& filename, uint64_t ram, uint64_t offset)
+            : m_buffer(filename, ram, offset * sizeof(bucket_payload_pair)) {}
 
         template <typename HashIterator>
         void add(bucket_id_type bucket_id, bucket_size_type bucket_size, HashIterator hashes) {
@@ -487,15 +524,21 @@ private:
         uint64_t m_next_bucket_id;
     };
 
+    struct temporary_files_manager;
+
+    /*
+        Write the pairs to sorted files of at most ram bytes each. Several writers of the
+        same temporary_files_manager can be used concurrently, from different threads.
+    */
     struct multifile_pairs_writer : buffer_t<bucket_payload_pair> {
-        multifile_pairs_writer(std::vector<std::string> const& filenames, uint64_t& num_pairs_files,
-                               uint64_t num_pairs, uint64_t ram, uint64_t num_threads_sort = 1,
-                               uint64_t ram_parallel_merge = 0)
+        multifile_pairs_writer(temporary_files_manager& tfm, uint64_t num_pairs, uint64_t ram,
+                               uint64_t num_threads_sort = 1, uint64_t ram_parallel_merge = 0,
+                               thread_pool* pool = nullptr)
             : buffer_t<bucket_payload_pair>(get_balanced_ram(num_pairs, ram))
-            , m_filenames(filenames)
-            , m_num_pairs_files(num_pairs_files)
+            , m_tfm(tfm)
             , m_num_threads_sort(num_threads_sort)
-            , m_ram_parallel_merge(ram_parallel_merge) {
+            , m_ram_parallel_merge(ram_parallel_merge)
+            , m_pool(pool) {
             assert(num_threads_sort > 1 or ram_parallel_merge == 0);
         }
 
@@ -507,7 +550,7 @@ private:
                 std::vector<memory_view<bucket_payload_pair>> blocks;
                 uint64_t num_keys_per_thread = (size + m_num_threads_sort - 1) / m_num_threads_sort;
                 for (uint64_t i = 0; i != m_num_threads_sort; ++i) {
-                    auto begin = buffer.data() + i * num_keys_per_thread;
+                    auto begin = buffer.data() + std::min(i * num_keys_per_thread, size);
                     auto end = buffer.data() + std::min((i + 1) * num_keys_per_thread, size);
                     uint64_t block_size = std::distance(begin, end);
                     blocks.emplace_back(begin, block_size);
@@ -518,22 +561,33 @@ private:
                     std::sort(blocks[tid].begin(), blocks[tid].end());
                 };
 
-                std::vector<std::thread> threads(m_num_threads_sort);
-                for (uint64_t i = 0; i != m_num_threads_sort; ++i) {
-                    threads[i] = std::thread(exe, i);
+                run_parallel(m_pool, m_num_threads_sort, exe);
+
+                /*
+                    Every thread merges a range of bucket ids into its own region of the file,
+                    starting from the position of the first pair of the range.
+                */
+                const std::string filename = m_tfm.new_pairs_filename();
+                {
+                    std::ofstream out(filename, std::ofstream::out | std::ofstream::binary);
+                    if (!out.is_open()) {
+                        throw std::runtime_error("cannot open temporary file (write)");
+                    }
                 }
-                for (uint64_t i = 0; i != m_num_threads_sort; ++i) {
-                    if (threads[i].joinable()) threads[i].join();
-                }
-                pairs_merger_t pairs_merger(m_filenames[m_num_pairs_files], m_ram_parallel_merge);
-                ++m_num_pairs_files;
-                merge(blocks, pairs_merger, false);
-                pairs_merger.close();
+                const uint64_t ram_per_thread =
+                    std::max<uint64_t>(m_ram_parallel_merge / m_num_threads_sort,
+                                       MAX_BUCKET_SIZE * sizeof(bucket_payload_pair));
+                merge_parallel(
+                    blocks, m_num_threads_sort, m_pool,
+                    [&](uint64_t, uint64_t offset, std::vector<pairs_view> const& range_blocks) {
+                        pairs_merger_t pairs_merger(filename, ram_per_thread, offset);
+                        merge(range_blocks, pairs_merger, false);
+                        pairs_merger.close();
+                    });
             } else {  // sequential
-                std::ofstream out(m_filenames[m_num_pairs_files],
+                std::ofstream out(m_tfm.new_pairs_filename(),
                                   std::ofstream::out | std::ofstream::binary);
                 if (!out.is_open()) throw std::runtime_error("cannot open temporary file (write)");
-                ++m_num_pairs_files;
                 std::sort(buffer.begin(), buffer.end());
                 out.write(reinterpret_cast<char const*>(buffer.data()),
                           size * sizeof(bucket_payload_pair));
@@ -542,10 +596,10 @@ private:
         }
 
     private:
-        std::vector<std::string> m_filenames;
-        uint64_t& m_num_pairs_files;
+        temporary_files_manager& m_tfm;
         uint64_t m_num_threads_sort;
         uint64_t m_ram_parallel_merge;
+        thread_pool* m_pool;
 
         static uint64_t get_balanced_ram(uint64_t num_pairs, uint64_t ram) {
             uint64_t num_pairs_per_file = ram / sizeof(bucket_payload_pair);
@@ -572,17 +626,15 @@ private:
 
         multifile_pairs_writer get_multifile_pairs_writer(uint64_t num_pairs, uint64_t ram,
                                                           uint64_t num_threads_sort = 1,
-                                                          uint64_t ram_parallel_merge = 0) {
-            uint64_t num_pairs_per_file = ram / sizeof(bucket_payload_pair);
-            uint64_t num_temporary_files =
-                (num_pairs + num_pairs_per_file - 1) / num_pairs_per_file;
-            std::vector<std::string> filenames;
-            filenames.reserve(num_temporary_files);
-            for (uint64_t i = 0; i < num_temporary_files; ++i) {
-                filenames.emplace_back(get_pairs_filename(m_num_pairs_files + i));
-            }
-            return multifile_pairs_writer(filenames, m_num_pairs_files, num_pairs, ram,
-                                          num_threads_sort, ram_parallel_merge);
+                                                          uint64_t ram_parallel_merge = 0,
+                                                          thread_pool* pool = nullptr) {
+            return multifile_pairs_writer(*this, num_pairs, ram, num_threads_sort,
+                                          ram_parallel_merge, pool);
+        }
+
+        /* The name of a new pairs file: safe to call from several threads. */
+        std::string new_pairs_filename() {
+            return get_pairs_filename(m_num_pairs_files++);
         }
 
         uint64_t get_num_pairs_files() const {
@@ -670,7 +722,7 @@ private:
 
         std::string m_dir_name;
         uint64_t m_run_identifier;
-        uint64_t m_num_pairs_files;
+        std::atomic<uint64_t> m_num_pairs_files;
         std::vector<bool> m_used_bucket_sizes;
     };
 
@@ -684,22 +736,43 @@ private:
         uint64_t ram_parallel_merge = 0;
         uint64_t num_threads = config.num_threads;
         if (num_threads > num_keys) num_threads = num_keys;
-        if (num_threads > 1) {
-            ram_parallel_merge = ram * 0.01;
-            assert(ram_parallel_merge >= MAX_BUCKET_SIZE * sizeof(bucket_payload_pair));
+        const uint64_t num_writers = num_hashing_threads<Iterator>(num_keys, num_threads);
+
+        /*
+            Every hashing thread maps its keys into its own writer, which sorts and writes
+            its own files. A single hashing thread sorts and merges with all the threads.
+        */
+        std::vector<multifile_pairs_writer> writers;
+        writers.reserve(num_writers);
+        if (num_writers > 1) {
+            const uint64_t num_pairs_per_writer = (num_keys + num_writers - 1) / num_writers;
+            for (uint64_t i = 0; i != num_writers; ++i) {
+                writers.push_back(
+                    tfm.get_multifile_pairs_writer(num_pairs_per_writer, ram / num_writers));
+            }
+        } else {
+            if (num_threads > 1) {
+                ram_parallel_merge = ram * 0.01;
+                assert(ram_parallel_merge >= MAX_BUCKET_SIZE * sizeof(bucket_payload_pair));
+            }
+            writers.push_back(tfm.get_multifile_pairs_writer(
+                num_keys, ram - ram_parallel_merge, num_threads, ram_parallel_merge, config.pool));
         }
 
-        auto writer = tfm.get_multifile_pairs_writer(num_keys, ram - ram_parallel_merge,
-                                                     num_threads, ram_parallel_merge);
+        std::mutex logger_mutex;  // only the progress logger is shared by the threads
         try {
-            for (uint64_t i = 0; i != num_keys; ++i, ++keys) {
-                auto const& key = *keys;
-                auto hash = hasher_type::hash(key, m_seed);
-                bucket_id_type bucket_id = m_bucketer.bucket(hash.first());
-                writer.emplace_back(bucket_id, hash.second());
-                logger.log();
-            }
-            writer.flush();
+            hash_keys<hasher_type>(
+                keys, num_keys, m_seed, num_threads, config.pool,
+                [&](uint64_t tid, hash_type const* hashes, uint64_t n) {
+                    auto& writer = writers[tid];
+                    for (uint64_t i = 0; i != n; ++i) {
+                        bucket_id_type bucket_id = m_bucketer.bucket(hashes[i].first());
+                        writer.emplace_back(bucket_id, hashes[i].second());
+                    }
+                    std::lock_guard<std::mutex> lock(logger_mutex);
+                    logger.log(n);
+                });
+            for (auto& writer : writers) writer.flush();
             logger.finalize();
         } catch (std::runtime_error const& e) { throw e; }
 
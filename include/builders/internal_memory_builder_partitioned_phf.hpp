@@ -5,9 +5,11 @@
 
 namespace pthash {
 
-template <typename Hasher>
+template <typename Hasher, typename RangeReducer = fastmod_reducer>
 struct internal_memory_builder_partitioned_phf {
     typedef Hasher hasher_type;
+    typedef RangeReducer range_reducer_type;
+    typedef internal_memory_builder_single_phf<Hasher, RangeReducer> partition_builder_type;
 
     template <typename Iterator>
     build_timings build_from_keys(Iterator keys, uint64_t num_keys,
@@ -18,8 +20,8 @@ struct internal_memory_builder_partitioned_phf {
                                  num_keys, actual_config);
     }
 
-    template <typename Iterator>
-    build_timings build_from_hashes(Iterator hashes, uint64_t num_keys,
+    template <typename RandomAccessIterator>
+    build_timings build_from_hashes(RandomAccessIterator hashes, uint64_t num_keys,
                                     build_configuration const& config) {
         assert(num_keys > 0);
         util::check_hash_collision_probability<Hasher>(num_keys);
@@ -27,6 +29,10 @@ struct internal_memory_builder_partitioned_phf {
         if (config.num_partitions == 0) {
             throw std::invalid_argument("number of partitions must be > 0");
         }
+        if (config.max_pilot > constants::unlimited_pilot) {
+            throw std::invalid_argument("max_pilot must be <= " +
+                                        std::to_string(constants::unlimited_pilot));
+        }
 
         auto start = clock_type::now();
 
@@ -36,7 +42,6 @@ struct internal_memory_builder_partitioned_phf {
         double average_partition_size = static_cast<double>(num_keys) / num_partitions;
         if (average_partition_size < constants::min_partition_size and num_partitions > 1) {
             num_partitions = 1;
-            average_partition_size = 1.0;
         }
 
         if (config.verbose_output) std::cout << "num_partitions " << num_partitions << std::endl;
@@ -49,17 +54,9 @@ struct internal_memory_builder_partitioned_phf {
         m_offsets.resize(num_partitions);
         m_builders.resize(num_partitions);
 
-        std::vector<std::vector<typename hasher_type::hash_type>> partitions(num_partitions);
-        for (auto& partition : partitions) partition.reserve(1.5 * average_partition_size);
-
-        progress_logger logger(num_keys, " == partitioned ", " keys", config.verbose_output);
-        for (uint64_t i = 0; i != num_keys; ++i, ++hashes) {
-            auto hash = *hashes;
-            auto b = m_bucketer.bucket(hash.mix());
-            partitions[b].push_back(hash);
-            logger.log();
-        }
-        logger.finalize();
+        std::vector<typename hasher_type::hash_type> partitioned_hashes(num_keys);
+        std::vector<hashes_view> partitions;
+        partition_hashes(hashes, num_keys, partitioned_hashes, partitions, config);
 
         for (uint64_t i = 0, cumulative_size = 0; i != num_partitions; ++i) {
             auto const& partition = partitions[i];
@@ -85,6 +82,7 @@ struct internal_memory_builder_partitioned_phf {
                                   config.num_threads);
         timings.mapping_ordering_seconds = t.mapping_ordering_seconds;
         timings.searching_seconds = t.searching_seconds;
+        timings.searching_trials = t.searching_trials;
 
         return timings;
     }
@@ -97,48 +95,84 @@ struct internal_memory_builder_partitioned_phf {
         assert(config.num_threads == 1);
 
         if (num_threads > 1) {  // parallel
-            std::vector<std::thread> threads(num_threads);
             std::vector<build_timings> thread_timings(num_threads);
+            std::vector<uint64_t> sizes(num_partitions);
+            for (uint64_t i = 0; i != num_partitions; ++i) sizes[i] = partitions[i].size();
 
-            auto exe = [&](uint64_t i, uint64_t begin, uint64_t end) {
-                for (; begin != end; ++begin) {
-                    auto const& partition = partitions[begin];
-                    auto t = builders[begin].build_from_hashes(partition.begin(), partition.size(),
-                                                               config);
-                    thread_timings[i].mapping_ordering_seconds += t.mapping_ordering_seconds;
-                    thread_timings[i].searching_seconds += t.searching_seconds;
-                }
-            };
-
-            uint64_t num_partitions_per_thread = (num_partitions + num_threads - 1) / num_threads;
-            for (uint64_t i = 0, begin = 0; i != num_threads; ++i) {
-                uint64_t end = begin + num_partitions_per_thread;
-                if (end > num_partitions) end = num_partitions;
-                threads[i] = std::thread(exe, i, begin, end);
-                begin = end;
-            }
-
-            for (auto& t : threads) {
-                if (t.joinable()) t.join();
-            }
+            /* the search time of a partition grows with its size: take the largest first */
+            auto order = largest_first(sizes);
+            run_tasks(order, num_threads, config.pool, [&](uint64_t thread, uint64_t i) {
+                auto const& partition = partitions[i];
+                auto t = build_partition(partition.begin(), partition.size(), builders[i], config);
+                thread_timings[thread].mapping_ordering_seconds += t.mapping_ordering_seconds;
+                thread_timings[thread].searching_seconds += t.searching_seconds;
+                thread_timings[thread].searching_trials += t.searching_trials;
+            });
 
             for (auto const& t : thread_timings) {
                 if (t.mapping_ordering_seconds > timings.mapping_ordering_seconds)
                     timings.mapping_ordering_seconds = t.mapping_ordering_seconds;
                 if (t.searching_seconds > timings.searching_seconds)
                     timings.searching_seconds = t.searching_seconds;
+                timings.searching_trials += t.searching_trials;
             }
         } else {  // sequential
             for (uint64_t i = 0; i != num_partitions; ++i) {
                 auto const& partition = partitions[i];
-                auto t = builders[i].build_from_hashes(partition.begin(), partition.size(), config);
+                auto t = build_partition(partition.begin(), partition.size(), builders[i], config);
                 timings.mapping_ordering_seconds += t.mapping_ordering_seconds;
                 timings.searching_seconds += t.searching_seconds;
+                timings.searching_trials += t.searching_trials;
             }
         }
         return timings;
     }
 
+    /*
+        Build the function of a partition. If the global seed fails on the partition,
+        only this partition is rebuilt: its hashes are rehashed with a seed of its own
+        (see rehash), which the builder records as its seed. The other partitions are
+        unaffected. Throw seed_runtime_error if none of the seeds works, or at once if
+        two keys have equal hashes: these stay equal under every seed.
+    */
+    template <typename Iterator>
+    static build_timings build_partition(Iterator hashes, uint64_t num_keys,
+                                         partition_builder_type& builder,
+                                         build_configuration const& config) {
+        try {
+            return builder.build_from_hashes(hashes, num_keys, config);
+        } catch (seed_runtime_error const&) {
+            if (has_equal_hashes(hashes, num_keys)) throw;
+        }
+        auto partition_config = config;
+        std::vector<typename hasher_type::hash_type> rehashed(num_keys);
+        for (uint64_t attempt = 1; attempt <= constants::max_partition_reseeds; ++attempt) {
+            /* deterministic, so that a build can be reproduced from the global seed */
+            uint64_t seed = default_hash64(attempt, config.seed);
+            if (seed == config.seed or seed == constants::invalid_seed) continue;
+            partition_config.seed = seed;
+            for (uint64_t i = 0; i != num_keys; ++i) rehashed[i] = rehash(hashes[i], seed);
+            try {
+                return builder.build_from_hashes(rehashed.begin(), num_keys, partition_config);
+            } catch (seed_runtime_error const&) {
+            }
+        }
+        throw seed_runtime_error();
+    }
+
+    /* Whether two of the hashes are equal, as a whole (e.g., for a duplicate key). */
+    template <typename Iterator>
+    static bool has_equal_hashes(Iterator hashes, uint64_t num_keys) {
+        std::vector<std::pair<uint64_t, uint64_t>> sorted;
+        sorted.reserve(num_keys);
+        for (uint64_t i = 0; i != num_keys; ++i, ++hashes) {
+            auto const& hash = *hashes;
+            sorted.emplace_back(hash.first(), hash.second());
+        }
+        std::sort(sorted.begin(), sorted.end());
+        return std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end();
+    }
+
     uint64_t seed() const {
         return m_seed;
     }
@@ -155,7 +189,7 @@ struct internal_memory_builder_partitioned_phf {
         return m_num_partitions;
     }
 
-    uniform_bucketer bucketer() const {
+    uniform_bucketer<RangeReducer> bucketer() const {
         return m_bucketer;
     }
 
@@ -163,18 +197,106 @@ struct internal_memory_builder_partitioned_phf {
         return m_offsets;
     }
 
-    std::vector<internal_memory_builder_single_phf<hasher_type>> const& builders() const {
+    std::vector<partition_builder_type> const& builders() const {
         return m_builders;
     }
 
 private:
+    typedef typename hasher_type::hash_type hash_type;
+
+    /* The hashes of a partition. */
+    struct hashes_view {
+        hashes_view(hash_type const* begin, uint64_t size) : m_begin(begin), m_size(size) {}
+
+        inline hash_type const* begin() const {
+            return m_begin;
+        }
+        inline uint64_t size() const {
+            return m_size;
+        }
+
+    private:
+        hash_type const* m_begin;
+        uint64_t m_size;
+    };
+
+    /*
+        Distribute the hashes into the partitions with config.num_threads threads, each
+        reading its own chunk of the input, in two passes. The first pass counts the keys
+        of every partition in every chunk, so that every thread knows where to write its
+        keys of every partition; the second pass computes the hashes again and scatters
+        them into partitioned_hashes, where partitions are contiguous and have their exact
+        size. Hashing twice avoids keeping either the hashes or the partition of every key
+        in memory between the passes.
+    */
+    template <typename RandomAccessIterator>
+    void partition_hashes(RandomAccessIterator hashes, uint64_t num_keys,
+                          std::vector<hash_type>& partitioned_hashes,
+                          std::vector<hashes_view>& partitions,
+                          build_configuration const& config) const {
+        const uint64_t num_partitions = m_num_partitions;
+        uint64_t num_threads = std::min(config.num_threads, num_keys);
+        if (num_threads == 0) num_threads = 1;
+        const uint64_t num_keys_per_thread = num_keys / num_threads;
+
+        auto run = [num_threads, &config](auto const& exe) {
+            if (num_threads == 1) {
+                exe(0);
+                return;
+            }
+            run_parallel(config.pool, num_threads, exe);
+        };
+
+        auto keys_of = [&](uint64_t tid) {
+            uint64_t begin = tid * num_keys_per_thread;
+            uint64_t end = (tid != num_threads - 1) ? begin + num_keys_per_thread : num_keys;
+            return std::make_pair(begin, end);
+        };
+
+        /* offsets[tid * num_partitions + p] is where thread tid writes its next key of p */
+        std::vector<uint64_t> offsets(num_threads * num_partitions, 0);
+        run([&](uint64_t tid) {
+            uint64_t* counts = offsets.data() + tid * num_partitions;
+            auto [begin, end] = keys_of(tid);
+            RandomAccessIterator it = hashes + begin;
+            for (uint64_t i = begin; i != end; ++i, ++it) ++counts[m_bucketer.bucket((*it).mix())];
+        });
+
+        partitions.clear();
+        partitions.reserve(num_partitions);
+        for (uint64_t p = 0, offset = 0; p != num_partitions; ++p) {
+            uint64_t partition_begin = offset;
+            for (uint64_t tid = 0; tid != num_threads; ++tid) {
+                uint64_t count = offsets[tid * num_partitions + p];
+                offsets[tid * num_partitions + p] = offset;
+                offset += count;
+            }
+            partitions.emplace_back(partitioned_hashes.data() + partition_begin,
+                                    offset - partition_begin);
+        }
+
+        progress_logger logger(num_keys, " == partitioned ", " keys",
+                               config.verbose_output and num_threads == 1);
+        run([&](uint64_t tid) {
+            uint64_t* local_offsets = offsets.data() + tid * num_partitions;
+            auto [begin, end] = keys_of(tid);
+            RandomAccessIterator it = hashes + begin;
+            for (uint64_t i = begin; i != end; ++i, ++it) {
+                auto hash = *it;
+                partitioned_hashes[local_offsets[m_bucketer.bucket(hash.mix())]++] = hash;
+                if (num_threads == 1) logger.log();
+            }
+        });
+        logger.finalize();
+    }
+
     uint64_t m_seed;
     uint64_t m_num_keys;
     uint64_t m_table_size;
     uint64_t m_num_partitions;
-    uniform_bucketer m_bucketer;
+    uniform_bucketer<RangeReducer> m_bucketer;
     std::vector<uint64_t> m_offsets;
-    std::vector<internal_memory_builder_single_phf<hasher_type>> m_builders;
+    std::vector<partition_builder_type> m_builders;
 };
 
 }  // namespace pthash
\ No newline at end of file
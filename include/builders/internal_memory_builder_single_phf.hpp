@@ -8,15 +8,17 @@
 
 namespace pthash {
 
-template <typename Hasher>
+template <typename Hasher, typename RangeReducer = fastmod_reducer>
 struct internal_memory_builder_single_phf {
     typedef Hasher hasher_type;
+    typedef RangeReducer range_reducer_type;
 
     internal_memory_builder_single_phf()
         : m_seed(constants::invalid_seed)
         , m_num_keys(0)
         , m_num_buckets(0)
         , m_table_size(0)
+        , m_max_pilot(constants::unlimited_pilot)
         , m_bucketer()
         , m_pilots()
         , m_free_slots() {}
@@ -51,6 +53,10 @@ struct internal_memory_builder_single_phf {
         if (config.alpha == 0 or config.alpha > 1.0) {
             throw std::invalid_argument("load factor must be > 0 and <= 1.0");
         }
+        if (config.max_pilot > constants::unlimited_pilot) {
+            throw std::invalid_argument("max_pilot must be <= " +
+                                        std::to_string(constants::unlimited_pilot));
+        }
 
         clock_type::time_point start;
 
@@ -69,6 +75,7 @@ struct internal_memory_builder_single_phf {
         m_num_keys = num_keys;
         m_table_size = table_size;
         m_num_buckets = num_buckets;
+        m_max_pilot = config.max_pilot;
         m_bucketer.init(m_num_buckets);
 
         if (config.verbose_output) {
@@ -80,7 +87,15 @@ struct internal_memory_builder_single_phf {
         }
 
         buckets_t buckets;
-        {
+        if (config.counting_sort) {
+            auto start = clock_type::now();
+            map_counting(hashes, num_keys, buckets, config);
+            auto elapsed = seconds(clock_type::now() - start);
+            if (config.verbose_output) {
+                std::cout << " == counting sort+check took: " << elapsed << " seconds"
+                          << std::endl;
+            }
+        } else {
             auto start = clock_type::now();
             std::vector<pairs_t> pairs_blocks;
             map(hashes, num_keys, pairs_blocks, config);
@@ -90,7 +105,7 @@ struct internal_memory_builder_single_phf {
             }
 
             start = clock_type::now();
-            merge(pairs_blocks, buckets, config.verbose_output);
+            merge_pairs(pairs_blocks, buckets, config);
             elapsed = seconds(clock_type::now() - start);
             if (config.verbose_output) {
                 std::cout << " == merge+check took: " << elapsed << " seconds" << std::endl;
@@ -125,8 +140,15 @@ struct internal_memory_builder_single_phf {
             bits::bit_vector::builder taken(m_table_size);
             uint64_t num_non_empty_buckets = buckets.num_buckets();
             pilots_wrapper_t pilots_wrapper(m_pilots);
-            search(m_num_keys, m_num_buckets, num_non_empty_buckets, m_seed, config,
-                   buckets_iterator, taken, pilots_wrapper);
+            m_bumped_keys.clear();
+            time.searching_trials =
+                search<RangeReducer>(m_num_keys, m_num_buckets, num_non_empty_buckets, m_seed,
+                                     config, buckets_iterator, taken, pilots_wrapper,
+                                     m_bumped_keys);
+            place_bumped_keys(m_bumped_keys, taken);
+            if (config.verbose_output) {
+                std::cout << " == bumped keys = " << m_bumped_keys.size() << std::endl;
+            }
             if (config.minimal_output) {
                 m_free_slots.clear();
                 m_free_slots.reserve(taken.num_bits() - num_keys);
@@ -153,7 +175,7 @@ struct internal_memory_builder_single_phf {
         return m_table_size;
     }
 
-    skew_bucketer bucketer() const {
+    skew_bucketer<RangeReducer> bucketer() const {
         return m_bucketer;
     }
 
@@ -165,14 +187,25 @@ struct internal_memory_builder_single_phf {
         return m_free_slots;
     }
 
+    uint64_t max_pilot() const {
+        return m_max_pilot;
+    }
+
+    /* The keys of the bumped buckets, sorted by bucket and payload. */
+    std::vector<bumped_key> const& bumped_keys() const {
+        return m_bumped_keys;
+    }
+
     void swap(internal_memory_builder_single_phf& other) {
         std::swap(m_seed, other.m_seed);
         std::swap(m_num_keys, other.m_num_keys);
         std::swap(m_num_buckets, other.m_num_buckets);
         std::swap(m_table_size, other.m_table_size);
+        std::swap(m_max_pilot, other.m_max_pilot);
         std::swap(m_bucketer, other.m_bucketer);
         m_pilots.swap(other.m_pilots);
         m_free_slots.swap(other.m_free_slots);
+        m_bumped_keys.swap(other.m_bumped_keys);
     }
 
     template <typename Visitor>
@@ -194,8 +227,19 @@ struct internal_memory_builder_single_phf {
                 ? (std::ceil((config.c * num_keys) / (num_keys > 1 ? std::log2(num_keys) : 1)))
                 : config.num_buckets;
 
-        uint64_t num_bytes_for_map = num_keys * sizeof(bucket_payload_pair)          // pairs
-                                     + (num_keys + num_buckets) * sizeof(uint64_t);  // buckets
+        /*
+            The arena of buckets is allocated with its final size once the pairs are sorted,
+            so that it never coexists with the buffer of the radix sort.
+        */
+        uint64_t num_bytes_for_pairs = num_keys * sizeof(bucket_payload_pair);
+        uint64_t num_bytes_for_buckets = (num_keys + num_buckets) * sizeof(uint64_t);
+        uint64_t num_bytes_for_map =
+            config.counting_sort
+                ? num_buckets * (sizeof(std::atomic<uint32_t>)  // sizes
+                                 + sizeof(uint64_t*))           // offsets
+                      + num_bytes_for_buckets
+                : std::max(num_bytes_for_pairs * (radix_sortable ? 2 : 1),  // sort
+                           num_bytes_for_pairs + num_bytes_for_buckets);    // merge
 
         uint64_t num_bytes_for_search =
             num_buckets * sizeof(uint64_t)    // pilots
@@ -215,95 +259,169 @@ private:
         visitor.visit(t.m_num_keys);
         visitor.visit(t.m_num_buckets);
         visitor.visit(t.m_table_size);
+        visitor.visit(t.m_max_pilot);
         visitor.visit(t.m_bucketer);
         visitor.visit(t.m_pilots);
         visitor.visit(t.m_free_slots);
+        visitor.visit(t.m_bumped_keys);
     }
 
     uint64_t m_seed;
     uint64_t m_num_keys;
     uint64_t m_num_buckets;
     uint64_t m_table_size;
-    skew_bucketer m_bucketer;
+    uint64_t m_max_pilot;
+    skew_bucketer<RangeReducer> m_bucketer;
     std::vector<uint64_t> m_pilots;
     std::vector<uint64_t> m_free_slots;
+    std::vector<bumped_key> m_bumped_keys;
 
     typedef std::vector<bucket_payload_pair> pairs_t;
 
+    /* Walks the buckets in the arena, from the largest to the smallest. */
     struct buckets_iterator_t {
-        buckets_iterator_t(std::vector<std::vector<uint64_t>> const& buffers)
-            : m_buffers_it(buffers.end() - 1), m_bucket_size(buffers.size()) {
-            m_bucket.init(m_buffers_it->data(), m_bucket_size);
-            skip_empty_buckets();
+        buckets_iterator_t(uint64_t const* data, uint64_t const* regions)
+            : m_data(data), m_regions(regions), m_ptr(data), m_bucket_size(MAX_BUCKET_SIZE) {
+            skip_empty_regions();
         }
 
         inline void operator++() {
-            uint64_t const* begin = m_bucket.begin() + m_bucket_size;
-            uint64_t const* end = m_buffers_it->data() + m_buffers_it->size();
-            m_bucket.init(begin, m_bucket_size);
-            if ((m_bucket.begin() - 1) == end and m_bucket_size != 0) {
-                --m_bucket_size;
-                --m_buffers_it;
-                skip_empty_buckets();
-            }
+            m_ptr += m_bucket_size + 1;
+            skip_empty_regions();
         }
 
         inline bucket_t operator*() const {
-            return m_bucket;
+            bucket_t bucket;
+            bucket.init(m_ptr, m_bucket_size);
+            return bucket;
         }
 
     private:
-        std::vector<std::vector<uint64_t>>::const_iterator m_buffers_it;
+        uint64_t const* m_data;
+        uint64_t const* m_regions;
+        uint64_t const* m_ptr;
         bucket_size_type m_bucket_size;
-        bucket_t m_bucket;
 
-        void skip_empty_buckets() {
-            while (m_bucket_size != 0 and m_buffers_it->empty()) {
+        /* the region of the buckets of size s ends where the region of size s - 1 begins */
+        void skip_empty_regions() {
+            while (m_bucket_size != 0 and m_ptr == m_data + m_regions[m_bucket_size - 1]) {
                 --m_bucket_size;
-                --m_buffers_it;
             }
-            if (m_bucket_size != 0) m_bucket.init(m_buffers_it->data(), m_bucket_size);
         }
     };
 
+    /*
+        All buckets in a single arena, laid out by decreasing size: every bucket takes
+        1 + s words, its id followed by its s payloads. The buckets are split into
+        segments, each holding a range of bucket ids, so that different threads can
+        fill different segments. Within the region of a size, segments follow each other
+        in order and buckets are sorted by id.
+        The arena is allocated once by init, from the number of buckets of every size in
+        every segment.
+    */
     struct buckets_t {
-        buckets_t() : m_buffers(MAX_BUCKET_SIZE), m_num_buckets(0) {}
+        buckets_t() : m_regions(MAX_BUCKET_SIZE + 1, 0), m_num_segments(0) {}
+
+        /*
+            num_buckets_of_size[i * (MAX_BUCKET_SIZE + 1) + s] is the number of buckets of
+            size s in the i-th segment.
+        */
+        void init(std::vector<uint64_t> const& num_buckets_of_size, uint64_t num_segments) {
+            assert(num_buckets_of_size.size() == num_segments * (MAX_BUCKET_SIZE + 1));
+            m_num_segments = num_segments;
+            m_segments.resize(num_segments * (MAX_BUCKET_SIZE + 1));
+            uint64_t offset = 0;
+            for (uint64_t size = MAX_BUCKET_SIZE; size != 0; --size) {
+                m_regions[size] = offset;
+                for (uint64_t i = 0; i != num_segments; ++i) {
+                    m_segments[i * (MAX_BUCKET_SIZE + 1) + size] = offset;
+                    offset += num_buckets_of_size[i * (MAX_BUCKET_SIZE + 1) + size] * (size + 1);
+                }
+            }
+            m_regions[0] = offset;
+            m_data.resize(offset);
+        }
 
-        template <typename HashIterator>
-        void add(bucket_id_type bucket_id, bucket_size_type bucket_size, HashIterator hashes) {
-            assert(bucket_size > 0);
-            uint64_t i = bucket_size - 1;
-            m_buffers[i].push_back(bucket_id);
-            for (uint64_t k = 0; k != bucket_size; ++k, ++hashes) m_buffers[i].push_back(*hashes);
-            ++m_num_buckets;
+        /* Where the buckets of the given size of the i-th segment begin. */
+        uint64_t* segment_begin(uint64_t i, bucket_size_type bucket_size) {
+            assert(i < m_num_segments and bucket_size > 0 and bucket_size <= MAX_BUCKET_SIZE);
+            return m_data.data() + m_segments[i * (MAX_BUCKET_SIZE + 1) + bucket_size];
+        }
+
+        /* Merger that appends the buckets of a segment. */
+        struct segment_t {
+            segment_t(buckets_t& buckets, uint64_t i) : m_next(MAX_BUCKET_SIZE + 1, nullptr) {
+                for (uint64_t size = 1; size <= MAX_BUCKET_SIZE; ++size) {
+                    m_next[size] = buckets.segment_begin(i, size);
+                }
+            }
+
+            template <typename HashIterator>
+            void add(bucket_id_type bucket_id, bucket_size_type bucket_size,
+                     HashIterator hashes) {
+                assert(bucket_size > 0 and bucket_size <= MAX_BUCKET_SIZE);
+                uint64_t*& next = m_next[bucket_size];
+                *next++ = bucket_id;
+                for (uint64_t k = 0; k != bucket_size; ++k, ++hashes) *next++ = *hashes;
+            }
+
+        private:
+            std::vector<uint64_t*> m_next;
+        };
+
+        segment_t segment(uint64_t i) {
+            return segment_t(*this, i);
         }
 
         uint64_t num_buckets() const {
-            return m_num_buckets;
+            uint64_t num_buckets = 0;
+            for (uint64_t size = 1; size <= MAX_BUCKET_SIZE; ++size) {
+                num_buckets += num_buckets_of_size(size);
+            }
+            return num_buckets;
         };
 
         buckets_iterator_t begin() const {
-            return buckets_iterator_t(m_buffers);
+            return buckets_iterator_t(m_data.data(), m_regions.data());
         }
 
         void print_bucket_size_distribution(uint64_t max_bucket_size, uint64_t num_buckets,
                                             double lambda_1, double lambda_2) {
-            for (int64_t i = max_bucket_size - 1; i >= 0; --i) {
-                uint64_t t = i + 1;
-                uint64_t num_buckets_of_size_t = m_buffers[i].size() / (t + 1);
+            for (uint64_t t = max_bucket_size; t != 0; --t) {
                 uint64_t estimated_num_buckets_of_size_t =
                     (constants::b * poisson_pmf(t, lambda_1) +
                      (1 - constants::b) * poisson_pmf(t, lambda_2)) *
                     num_buckets;
-                std::cout << " == num_buckets of size " << t << " = " << num_buckets_of_size_t
+                std::cout << " == num_buckets of size " << t << " = " << num_buckets_of_size(t)
                           << " (estimated with Poisson = " << estimated_num_buckets_of_size_t << ")"
                           << std::endl;
             }
         }
 
     private:
-        std::vector<std::vector<uint64_t>> m_buffers;
-        uint64_t m_num_buckets;
+        std::vector<uint64_t> m_data;
+        std::vector<uint64_t> m_regions;   // size-s buckets are in [m_regions[s], m_regions[s-1])
+        std::vector<uint64_t> m_segments;  // where the buckets of each (segment, size) begin
+        uint64_t m_num_segments;
+
+        uint64_t num_buckets_of_size(uint64_t size) const {
+            return (m_regions[size - 1] - m_regions[size]) / (size + 1);
+        }
+    };
+
+    /* Counts the buckets of every size, without storing them. */
+    struct bucket_size_counter {
+        bucket_size_counter(uint64_t* num_buckets_of_size)
+            : m_num_buckets_of_size(num_buckets_of_size) {}
+
+        template <typename HashIterator>
+        void add(bucket_id_type, bucket_size_type bucket_size, HashIterator) {
+            if (bucket_size > MAX_BUCKET_SIZE) throw seed_runtime_error();
+            ++m_num_buckets_of_size[bucket_size];
+        }
+
+    private:
+        uint64_t* m_num_buckets_of_size;
     };
 
     struct pilots_wrapper_t {
@@ -317,6 +435,13 @@ private:
         std::vector<uint64_t>& m_pilots;
     };
 
+    /*
+        The pairs are sorted with a radix sort on the bucket ids, unless bucket ids are
+        64-bit integers: then every thread sorts its own block with std::sort and the
+        blocks are merged afterwards.
+    */
+    static constexpr bool radix_sortable = sizeof(bucket_id_type) == sizeof(uint32_t);
+
     template <typename RandomAccessIterator>
     void map_sequential(RandomAccessIterator hashes, uint64_t num_keys,
                         std::vector<pairs_t>& pairs_blocks, build_configuration const&) const {
@@ -327,7 +452,11 @@ private:
             auto bucket_id = m_bucketer.bucket(hash.first());
             pairs[i] = {static_cast<bucket_id_type>(bucket_id), hash.second()};
         }
-        std::sort(pairs.begin(), pairs.end());
+        if constexpr (radix_sortable) {
+            radix_sort_pairs(pairs, m_num_buckets, 1, nullptr);
+        } else {
+            std::sort(pairs.begin(), pairs.end());
+        }
         pairs_blocks.resize(1);
         pairs_blocks.front().swap(pairs);
     }
@@ -335,32 +464,205 @@ private:
     template <typename RandomAccessIterator>
     void map_parallel(RandomAccessIterator hashes, uint64_t num_keys,
                       std::vector<pairs_t>& pairs_blocks, build_configuration const& config) const {
-        pairs_blocks.resize(config.num_threads);
         uint64_t num_keys_per_thread = num_keys / config.num_threads;
+        pairs_t pairs;
+        if constexpr (radix_sortable) {
+            pairs.resize(num_keys);
+        } else {
+            pairs_blocks.resize(config.num_threads);
+        }
 
         auto exe = [&](uint64_t tid) {
-            auto& local_pairs = pairs_blocks[tid];
             RandomAccessIterator begin = hashes + tid * num_keys_per_thread;
             uint64_t local_num_keys = (tid != config.num_threads - 1)
                                           ? num_keys_per_thread
                                           : (num_keys - tid * num_keys_per_thread);
-            local_pairs.resize(local_num_keys);
+            bucket_payload_pair* local_pairs;
+            if constexpr (radix_sortable) {
+                local_pairs = pairs.data() + tid * num_keys_per_thread;
+            } else {
+                pairs_blocks[tid].resize(local_num_keys);
+                local_pairs = pairs_blocks[tid].data();
+            }
 
             for (uint64_t local_i = 0; local_i != local_num_keys; ++local_i, ++begin) {
                 auto hash = *begin;
                 auto bucket_id = m_bucketer.bucket(hash.first());
                 local_pairs[local_i] = {static_cast<bucket_id_type>(bucket_id), hash.second()};
             }
-            std::sort(local_pairs.begin(), local_pairs.end());
+            if constexpr (!radix_sortable) {
+                std::sort(pairs_blocks[tid].begin(), pairs_blocks[tid].end());
+            }
         };
 
-        std::vector<std::thread> threads(config.num_threads);
-        for (uint64_t i = 0; i != config.num_threads; ++i) threads[i] = std::thread(exe, i);
-        for (auto& t : threads) {
-            if (t.joinable()) t.join();
+        run_parallel(config.pool, config.num_threads, exe);
+
+        if constexpr (radix_sortable) {
+            radix_sort_pairs(pairs, m_num_buckets, config.num_threads, config.pool);
+            pairs_blocks.resize(1);
+            pairs_blocks.front().swap(pairs);
         }
     }
 
+    /*
+        Merge the sorted pairs into buckets with config.num_threads threads, each merging
+        a range of bucket ids into its own segment. A first merge only counts the buckets
+        of every size in every range, so that the arena can be allocated with its final
+        size and the second merge writes every bucket directly to its place.
+    */
+    void merge_pairs(std::vector<pairs_t> const& pairs_blocks, buckets_t& buckets,
+                     build_configuration const& config) const {
+        const uint64_t num_threads = std::max<uint64_t>(config.num_threads, 1);
+        std::vector<uint64_t> num_buckets_of_size(num_threads * (MAX_BUCKET_SIZE + 1), 0);
+        merge_parallel(pairs_blocks, num_threads, config.pool,
+                       [&](uint64_t range, uint64_t, std::vector<pairs_view> const& blocks) {
+                           bucket_size_counter counter(num_buckets_of_size.data() +
+                                                       range * (MAX_BUCKET_SIZE + 1));
+                           merge(blocks, counter, false);
+                       });
+        buckets.init(num_buckets_of_size, num_threads);
+        merge_parallel(pairs_blocks, num_threads, config.pool,
+                       [&](uint64_t range, uint64_t, std::vector<pairs_view> const& blocks) {
+                           auto segment = buckets.segment(range);
+                           merge(blocks, segment, config.verbose_output and num_threads == 1);
+                       });
+    }
+
+    /*
+        Bucketize the keys without sorting bucket-payload pairs: a first pass over the
+        hashes counts the size of every bucket, so that every bucket is given its final
+        place in buckets, and a second pass scatters the hashes into their buckets.
+        Payloads are then sorted within each bucket, as after map and merge, and
+        checked for duplicates.
+    */
+    template <typename RandomAccessIterator>
+    void map_counting(RandomAccessIterator hashes, uint64_t num_keys, buckets_t& buckets,
+                      build_configuration const& config) const {
+        uint64_t num_threads = std::min(config.num_threads, num_keys);
+        if (num_threads == 0) num_threads = 1;
+        const uint64_t num_keys_per_thread = num_keys / num_threads;
+        const uint64_t num_buckets_per_thread = (m_num_buckets + num_threads - 1) / num_threads;
+
+        auto run = [num_threads, &config](auto const& exe) {
+            if (num_threads == 1) {
+                exe(0);
+                return;
+            }
+            run_parallel(config.pool, num_threads, exe);
+        };
+
+        /* every thread reads the keys [begin, end) and owns the buckets [first, last) */
+        auto keys_of = [&](uint64_t tid) {
+            uint64_t begin = tid * num_keys_per_thread;
+            uint64_t end = (tid != num_threads - 1) ? begin + num_keys_per_thread : num_keys;
+            return std::make_pair(begin, end);
+        };
+        auto buckets_of = [&](uint64_t tid) {
+            uint64_t first = std::min(tid * num_buckets_per_thread, m_num_buckets);
+            uint64_t last = std::min(first + num_buckets_per_thread, m_num_buckets);
+            return std::make_pair(first, last);
+        };
+
+        /*
+            1. histogram of the bucket sizes. Sizes are updated with atomic instructions
+            only if several threads are used: locked instructions would otherwise prevent
+            the cache misses of consecutive keys from overlapping.
+            Sizes are counted on 32 bits, not as bucket_size_type: a bucket with too many
+            keys (e.g., many copies of a key) must be detected, not wrap around.
+        */
+        std::vector<std::atomic<uint32_t>> sizes(m_num_buckets);
+        auto add_to_size = [&](uint64_t bucket_id, int delta) -> uint64_t {
+            if (num_threads == 1) {
+                uint64_t size = sizes[bucket_id].load(std::memory_order_relaxed);
+                sizes[bucket_id].store(size + delta, std::memory_order_relaxed);
+                return size;
+            }
+            return sizes[bucket_id].fetch_add(delta, std::memory_order_relaxed);
+        };
+        std::atomic<bool> too_large(false);
+        run([&](uint64_t tid) {
+            auto [begin, end] = keys_of(tid);
+            RandomAccessIterator it = hashes + begin;
+            for (uint64_t i = begin; i != end; ++i, ++it) {
+                uint64_t bucket_id = m_bucketer.bucket((*it).first());
+                if (PTHASH_LIKELY(add_to_size(bucket_id, 1) < MAX_BUCKET_SIZE)) continue;
+                /* stop before the size of the bucket can overflow */
+                too_large = true;
+                return;
+            }
+        });
+        if (too_large) throw seed_runtime_error();
+
+        /*
+            2. layout: every thread owns a segment of the arena, holding the buckets of
+            its range of bucket ids, placed by increasing bucket id
+        */
+        std::vector<uint64_t> counts(num_threads * (MAX_BUCKET_SIZE + 1), 0);
+        run([&](uint64_t tid) {
+            auto [first, last] = buckets_of(tid);
+            uint64_t* local_counts = counts.data() + tid * (MAX_BUCKET_SIZE + 1);
+            for (uint64_t bucket_id = first; bucket_id != last; ++bucket_id) {
+                ++local_counts[sizes[bucket_id].load(std::memory_order_relaxed)];
+            }
+        });
+
+        buckets.init(counts, num_threads);
+
+        /* the buckets of size s of thread tid are in [begins[tid][s], ends[tid][s]) */
+        std::vector<uint64_t*> begins(num_threads * (MAX_BUCKET_SIZE + 1), nullptr);
+        std::vector<uint64_t*> ends(num_threads * (MAX_BUCKET_SIZE + 1), nullptr);
+        std::vector<uint64_t*> bucket_begin(m_num_buckets);
+        run([&](uint64_t tid) {
+            auto [first, last] = buckets_of(tid);
+            uint64_t** local_begins = begins.data() + tid * (MAX_BUCKET_SIZE + 1);
+            uint64_t** next = ends.data() + tid * (MAX_BUCKET_SIZE + 1);
+            for (uint64_t size = 1; size <= MAX_BUCKET_SIZE; ++size) {
+                local_begins[size] = next[size] = buckets.segment_begin(tid, size);
+            }
+            for (uint64_t bucket_id = first; bucket_id != last; ++bucket_id) {
+                uint64_t size = sizes[bucket_id].load(std::memory_order_relaxed);
+                if (size == 0) continue;
+                *next[size] = bucket_id;
+                bucket_begin[bucket_id] = next[size];
+                next[size] += size + 1;
+            }
+        });
+
+        /* 3. scatter: the size of a bucket counts down to 0 as its payloads are written */
+        run([&](uint64_t tid) {
+            auto [begin, end] = keys_of(tid);
+            RandomAccessIterator it = hashes + begin;
+            for (uint64_t i = begin; i != end; ++i, ++it) {
+                auto hash = *it;
+                uint64_t bucket_id = m_bucketer.bucket(hash.first());
+                uint64_t k = add_to_size(bucket_id, -1);
+                bucket_begin[bucket_id][k] = hash.second();
+            }
+        });
+
+        /* 4. sort the payloads of every bucket and check for duplicates */
+        std::atomic<bool> duplicate(false);
+        run([&](uint64_t tid) {
+            for (uint64_t size = 1; size <= MAX_BUCKET_SIZE; ++size) {
+                uint64_t* end = ends[tid * (MAX_BUCKET_SIZE + 1) + size];
+                for (uint64_t* bucket = begins[tid * (MAX_BUCKET_SIZE + 1) + size]; bucket != end;
+                     bucket += size + 1) {
+                    uint64_t* payloads = bucket + 1;
+                    for (uint64_t i = 1; i < size; ++i) {
+                        uint64_t payload = payloads[i];
+                        uint64_t j = i;
+                        for (; j > 0 and payload < payloads[j - 1]; --j) {
+                            payloads[j] = payloads[j - 1];
+                        }
+                        if (j > 0 and payload == payloads[j - 1]) duplicate = true;
+                        payloads[j] = payload;
+                    }
+                }
+            }
+        });
+        if (duplicate) throw seed_runtime_error();
+    }
+
     template <typename RandomAccessIterator>
     void map(RandomAccessIterator hashes, uint64_t num_keys, std::vector<pairs_t>& pairs_blocks,
              build_configuration const& config) const {
@@ -4,11 +4,15 @@
 #include <sstream>  // for stringbuf
 #include <atomic>   // for std::atomic
 #include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <exception>  // for std::exception_ptr
 
 #include "external/bits/include/bit_vector.hpp"
 
 #include "include/builders/util.hpp"
 #include "include/utils/hasher.hpp"
+#include "include/utils/bucketers.hpp"
 
 namespace pthash {
 
@@ -29,6 +33,7 @@ struct search_logger {
 
     void init() {
         essentials::logger("search starts");
+        m_start = clock_type::now();
         m_timer.start();
     }
 
@@ -71,6 +76,8 @@ struct search_logger {
         std::cout << " == " << m_num_buckets - bucket << " empty buckets ("
                   << ((m_num_buckets - bucket) * 100.0) / m_num_buckets << "%)" << std::endl;
         std::cout << " == total trials = " << m_total_trials << std::endl;
+        std::cout << " == trials per second = "
+                  << m_total_trials / seconds(clock_type::now() - m_start) << std::endl;
         std::cout << " == total expected trials = " << uint64_t(m_total_expected_trials)
                   << std::endl;
     }
@@ -88,6 +95,7 @@ private:
     double m_expected_trials;
     double m_total_expected_trials;
 
+    clock_type::time_point m_start;
     essentials::timer<std::chrono::high_resolution_clock, std::chrono::seconds> m_timer;
 
     void print(uint64_t bucket) {
@@ -108,152 +116,348 @@ private:
     }
 };
 
-template <typename BucketsIterator, typename PilotsBuffer>
-void search_sequential(uint64_t num_keys, uint64_t num_buckets, uint64_t num_non_empty_buckets,
-                       uint64_t seed, build_configuration const& config, BucketsIterator& buckets,
-                       bits::bit_vector::builder& taken, PilotsBuffer& pilots) {
-    const uint64_t max_bucket_size = (*buckets).size();
-    const uint64_t table_size = taken.num_bits();
-    const __uint128_t M = fastmod::computeM_u64(table_size);
-
-    std::vector<uint64_t> positions;
-    positions.reserve(max_bucket_size);
+/*
+    Up to this size, duplicates are detected with all the pairwise compares, that
+    are branch-free and have no dependencies among them. Larger arrays are sorted.
+*/
+constexpr uint64_t max_pairwise_check_size = 16;
+
+template <uint64_t N>
+inline bool has_duplicates_pairwise(uint64_t const* values) {
+    bool equal = false;
+    for (uint64_t i = 0; i != N; ++i) {
+        for (uint64_t j = i + 1; j != N; ++j) equal |= values[i] == values[j];
+    }
+    return equal;
+}
 
-    std::vector<uint64_t> hashed_pilots_cache(search_cache_size);
-    for (uint64_t pilot = 0; pilot != search_cache_size; ++pilot) {
-        hashed_pilots_cache[pilot] = default_hash64(pilot, seed);
+template <uint64_t N = 2>
+inline bool has_duplicates_small(uint64_t const* values, uint64_t n) {
+    if constexpr (N == max_pairwise_check_size) {
+        assert(n == N);
+        return has_duplicates_pairwise<N>(values);
+    } else {
+        if (n == N) return has_duplicates_pairwise<N>(values);
+        return has_duplicates_small<N + 1>(values, n);
     }
+}
 
-    search_logger log(num_keys, table_size, num_buckets);
-    if (config.verbose_output) log.init();
+/* Return true if values[0..n) contains duplicates. The values may be reordered. */
+inline bool has_duplicates(uint64_t* values, uint64_t n) {
+    if (n < 2) return false;
+    if (n <= max_pairwise_check_size) return has_duplicates_small(values, n);
+    std::sort(values, values + n);
+    return std::adjacent_find(values, values + n) != values + n;
+}
 
-    uint64_t processed_buckets = 0;
-    for (; processed_buckets < num_non_empty_buckets; ++processed_buckets, ++buckets) {
-        auto const& bucket = *buckets;
-        assert(bucket.size() > 0);
+/*
+    Finds the pilot of a bucket: the smallest pilot for which the keys of the bucket
+    fall into distinct free slots of the table.
+    Pilots are tested search_batch_size at a time, key by key: the range reductions
+    and the accesses to the bitmap of the different pilots are independent, so they
+    overlap instead of forming one chain per pilot, and testing stops as soon as all
+    pilots of the batch hit a taken slot. Only the pilots that survive all keys are
+    then checked for collisions within the bucket.
+*/
+template <typename RangeReducer>
+struct pilot_finder {
+    static constexpr uint64_t search_batch_size = 8;
+    static_assert(search_cache_size % search_batch_size == 0);
+
+    pilot_finder(uint64_t seed, uint64_t table_size, uint64_t max_pilot,
+                 bits::bit_vector::builder& taken)
+        : m_seed(seed)
+        , m_max_pilot(max_pilot)
+        , m_taken(taken)
+        , m_taken_words(taken.data().data())
+        , m_hashed_pilots_cache(search_cache_size) {
+        m_position.init(table_size);
+        for (uint64_t pilot = 0; pilot != search_cache_size; ++pilot) {
+            m_hashed_pilots_cache[pilot] = default_hash64(pilot, seed);
+        }
+    }
 
-        for (uint64_t pilot = 0; true; ++pilot) {
-            uint64_t hashed_pilot = PTHASH_LIKELY(pilot < search_cache_size)
-                                        ? hashed_pilots_cache[pilot]
-                                        : default_hash64(pilot, seed);
+    /*
+        Throw seed_runtime_error if no pilot can place the bucket, i.e., if two of its
+        keys have the same hash: the search for its pilot would never end otherwise.
+        Positions are used as scratch space.
+    */
+    static void check_separable(bucket_t const& bucket, std::vector<uint64_t>& positions) {
+        positions.assign(bucket.begin(), bucket.end());
+        if (has_duplicates(positions.data(), positions.size())) throw seed_runtime_error();
+    }
 
-            positions.clear();
+    /*
+        Prefetch the words of the bitmap that the first batch of pilots tests
+        for the first key of the bucket.
+    */
+    void prefetch(bucket_t const& bucket) const {
+        prefetch_slots(*bucket.begin(), m_hashed_pilots_cache.data());
+    }
 
-            auto bucket_begin = bucket.begin(), bucket_end = bucket.end();
-            for (; bucket_begin != bucket_end; ++bucket_begin) {
-                uint64_t hash = *bucket_begin;
-                uint64_t p = fastmod::fastmod_u64(hash ^ hashed_pilot, M, table_size);
-                if (taken.get(p)) break;
-                positions.push_back(p);
+    /* The pilot of the buckets for which no pilot <= max_pilot works. */
+    uint64_t bumped_pilot() const {
+        return m_max_pilot + 1;
+    }
+
+    /*
+        Return the smallest pilot >= pilot that works for the bucket, and write to
+        positions the slots of its keys, or bumped_pilot() if there is no such pilot
+        <= max_pilot.
+        The words of the bitmap for the next batch of pilots are prefetched
+        while the current batch is tested.
+    */
+    uint64_t find(bucket_t const& bucket, uint64_t pilot, std::vector<uint64_t>& positions) const {
+        uint64_t hashed_pilots[2][search_batch_size];
+        uint64_t const* batch = hashed_batch(pilot, hashed_pilots[0]);
+        for (uint64_t next = 1;; pilot += search_batch_size, next ^= 1) {
+            if (pilot > m_max_pilot) return bumped_pilot();
+            uint64_t const* next_batch =
+                hashed_batch(pilot + search_batch_size, hashed_pilots[next]);
+            prefetch_slots(*bucket.begin(), next_batch);
+
+            for (uint64_t mask = free_slots_mask(bucket, batch); mask != 0; mask &= mask - 1) {
+                uint64_t i = __builtin_ctzll(mask);
+                if (pilot + i > m_max_pilot) return bumped_pilot();
+                positions.clear();
+                for (uint64_t hash : bucket) {
+                    positions.push_back(m_position.reduce(hash ^ batch[i]));
+                }
+                // check for in-bucket collisions
+                if (!has_duplicates(positions.data(), positions.size())) return pilot + i;
             }
 
-            if (bucket_begin == bucket_end) {  // all keys do not have collisions with taken
+            batch = next_batch;
+        }
+    }
+
+private:
+    uint64_t m_seed;
+    uint64_t m_max_pilot;
+    RangeReducer m_position;
+    bits::bit_vector::builder const& m_taken;
+    uint64_t const* m_taken_words;
+    std::vector<uint64_t> m_hashed_pilots_cache;
+
+    /* The hashes of the pilots [pilot, pilot + search_batch_size), from the cache if possible. */
+    inline uint64_t const* hashed_batch(uint64_t pilot, uint64_t* buffer) const {
+        if (PTHASH_LIKELY(pilot + search_batch_size <= search_cache_size)) {
+            return m_hashed_pilots_cache.data() + pilot;
+        }
+        for (uint64_t i = 0; i != search_batch_size; ++i) {
+            buffer[i] = default_hash64(pilot + i, m_seed);
+        }
+        return buffer;
+    }
 
-                // check for in-bucket collisions
-                std::sort(positions.begin(), positions.end());
-                auto it = std::adjacent_find(positions.begin(), positions.end());
-                if (it != positions.end())
-                    continue;  // in-bucket collision detected, try next pilot
+    inline void reduce_batch(uint64_t hash, uint64_t const* hashed_pilots, uint64_t* p) const {
+        for (uint64_t i = 0; i != search_batch_size; ++i) {
+            p[i] = m_position.reduce(hash ^ hashed_pilots[i]);
+        }
+    }
 
-                pilots.emplace_back(bucket.id(), pilot);
-                for (auto p : positions) {
-                    assert(taken.get(p) == false);
-                    taken.set(p, true);
+    inline void prefetch_slots(uint64_t hash, uint64_t const* hashed_pilots) const {
+        uint64_t p[search_batch_size];
+        reduce_batch(hash, hashed_pilots, p);
+        for (uint64_t i = 0; i != search_batch_size; ++i) {
+            PTHASH_PREFETCH(m_taken_words + (p[i] >> 6));
+        }
+    }
+
+    /*
+        Bit i is set if no key of the bucket falls into a taken slot with hashed_pilots[i].
+        The slots of the next key are computed, and their words prefetched, before the
+        bits of the current key are read.
+    */
+    inline uint64_t free_slots_mask(bucket_t const& bucket, uint64_t const* hashed_pilots) const {
+        uint64_t mask = (uint64_t(1) << search_batch_size) - 1;
+        uint64_t p[2][search_batch_size];
+        auto it = bucket.begin();
+        reduce_batch(*it, hashed_pilots, p[0]);
+        for (uint64_t curr = 0; mask != 0; curr ^= 1) {
+            bool last = ++it == bucket.end();
+            if (!last) {
+                reduce_batch(*it, hashed_pilots, p[curr ^ 1]);
+                for (uint64_t i = 0; i != search_batch_size; ++i) {
+                    PTHASH_PREFETCH(m_taken_words + (p[curr ^ 1][i] >> 6));
                 }
-                if (config.verbose_output) log.update(processed_buckets, bucket.size(), pilot);
-                break;
             }
+            for (uint64_t i = 0; i != search_batch_size; ++i) {
+                mask &= ~(uint64_t(m_taken.get(p[curr][i])) << i);
+            }
+            if (last) break;
         }
+        return mask;
+    }
+};
+
+/*
+    The search functions return the number of pilots tested, i.e., the sum of all pilots + 1.
+    The keys of the bumped buckets are appended to bumped_keys, without a slot.
+*/
+template <typename RangeReducer, typename BucketsIterator, typename PilotsBuffer>
+uint64_t search_sequential(uint64_t num_keys, uint64_t num_buckets, uint64_t num_non_empty_buckets,
+                           uint64_t seed, build_configuration const& config,
+                           BucketsIterator& buckets, bits::bit_vector::builder& taken,
+                           PilotsBuffer& pilots, std::vector<bumped_key>& bumped_keys) {
+    const uint64_t max_bucket_size = (*buckets).size();
+    const uint64_t table_size = taken.num_bits();
+    pilot_finder<RangeReducer> finder(seed, table_size, config.max_pilot, taken);
+
+    std::vector<uint64_t> positions;
+    positions.reserve(max_bucket_size);
+
+    search_logger log(num_keys, table_size, num_buckets);
+    if (config.verbose_output) log.init();
+
+    uint64_t num_trials = 0;
+    uint64_t processed_buckets = 0;
+    bucket_t next_bucket = *buckets;
+    for (; processed_buckets < num_non_empty_buckets; ++processed_buckets) {
+        bucket_t bucket = next_bucket;
+        assert(bucket.size() > 0);
+        ++buckets;
+        if (processed_buckets + 1 < num_non_empty_buckets) {
+            // the bitmap words of the next bucket are loaded while this one is searched
+            next_bucket = *buckets;
+            finder.prefetch(next_bucket);
+        }
+        finder.check_separable(bucket, positions);
+        uint64_t pilot = finder.find(bucket, 0, positions);
+        num_trials += pilot + 1;
+        pilots.emplace_back(bucket.id(), pilot);
+        if (pilot == finder.bumped_pilot()) {
+            for (uint64_t hash : bucket) bumped_keys.push_back({bucket.id(), hash, 0});
+        } else {
+            for (auto p : positions) {
+                assert(taken.get(p) == false);
+                taken.set(p, true);
+            }
+        }
+        if (config.verbose_output) log.update(processed_buckets, bucket.size(), pilot);
     }
 
     if (config.verbose_output) log.finalize(processed_buckets);
+    return num_trials;
 }
 
-template <typename BucketsIterator, typename PilotsBuffer>
-void search_parallel(uint64_t num_keys, uint64_t num_buckets, uint64_t num_non_empty_buckets,
-                     uint64_t seed, build_configuration const& config, BucketsIterator& buckets,
-                     bits::bit_vector::builder& taken, PilotsBuffer& pilots) {
+/*
+    Wait for a condition that other threads make true: spin for spin_count rounds
+    with a pause instruction, that frees resources for the sibling hyper-thread,
+    then yield the processor for a few rounds and finally sleep on a condition
+    variable (a futex on Linux) until a notify. Spinning first keeps the latency
+    low when the wait is short; sleeping avoids burning CPU time when it is not,
+    or when there are more threads than available cores.
+*/
+struct backoff_waiter {
+    backoff_waiter(uint64_t spin_count) : m_spin_count(spin_count), m_num_sleeping(0) {}
+
+    template <typename Predicate>
+    void wait(Predicate ready) {
+        for (uint64_t i = 0; i != m_spin_count; ++i) {
+            if (ready()) return;
+            PTHASH_PAUSE();
+        }
+        for (uint64_t i = 0; i != num_yields; ++i) {
+            if (ready()) return;
+            std::this_thread::yield();
+        }
+        ++m_num_sleeping;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, ready);
+        }
+        --m_num_sleeping;
+    }
+
+    /* Must be called after every change that can make the condition of a waiter true. */
+    void notify() {
+        if (m_num_sleeping != 0) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_condition.notify_all();
+        }
+    }
+
+private:
+    static constexpr uint64_t num_yields = 16;
+    uint64_t m_spin_count;
+    std::atomic<uint64_t> m_num_sleeping;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+};
+
+template <typename RangeReducer, typename BucketsIterator, typename PilotsBuffer>
+uint64_t search_parallel(uint64_t num_keys, uint64_t num_buckets, uint64_t num_non_empty_buckets,
+                         uint64_t seed, build_configuration const& config, BucketsIterator& buckets,
+                         bits::bit_vector::builder& taken, PilotsBuffer& pilots,
+                         std::vector<bumped_key>& bumped_keys) {
     const uint64_t max_bucket_size = (*buckets).size();
     const uint64_t table_size = taken.num_bits();
-    const __uint128_t M = fastmod::computeM_u64(table_size);
+    pilot_finder<RangeReducer> finder(seed, table_size, config.max_pilot, taken);
 
     const uint64_t num_threads = config.num_threads;
-    std::vector<uint64_t> hashed_pilots_cache(search_cache_size);
-    for (uint64_t pilot = 0; pilot != search_cache_size; ++pilot) {
-        hashed_pilots_cache[pilot] = default_hash64(pilot, seed);
-    }
 
     search_logger log(num_keys, table_size, num_buckets);
     if (config.verbose_output) log.init();
 
+    uint64_t num_trials = 0;  // only updated by the thread holding next_bucket_idx
     std::atomic<uint64_t> next_bucket_idx = 0;
     static_assert(next_bucket_idx.is_always_lock_free);
+    backoff_waiter waiter(config.search_spin_count);
 
-    auto exe = [&](uint64_t local_bucket_idx, bucket_t bucket) {
-        std::vector<uint64_t> positions;
+    /* Set when a thread fails: the others must stop instead of waiting for its bucket. */
+    std::atomic<bool> aborted = false;
+    std::vector<std::exception_ptr> exceptions(num_threads);
+
+    auto search_buckets = [&](uint64_t local_bucket_idx, bucket_t bucket) {
+        /* kept by the threads of a pool from one search to the next */
+        std::vector<uint64_t>& positions = thread_pool::scratch();
         positions.reserve(max_bucket_size);
 
         while (true) {
             uint64_t pilot = 0;
             bool pilot_checked = false;
+            finder.check_separable(bucket, positions);
 
             while (true) {
                 uint64_t local_next_bucket_idx = next_bucket_idx;
 
-                for (; true; ++pilot) {
-                    if (PTHASH_LIKELY(!pilot_checked)) {
-                        uint64_t hashed_pilot = PTHASH_LIKELY(pilot < search_cache_size)
-                                                    ? hashed_pilots_cache[pilot]
-                                                    : default_hash64(pilot, seed);
-
-                        positions.clear();
-
-                        auto bucket_begin = bucket.begin(), bucket_end = bucket.end();
-                        for (; bucket_begin != bucket_end; ++bucket_begin) {
-                            uint64_t hash = *bucket_begin;
-                            uint64_t p = fastmod::fastmod_u64(hash ^ hashed_pilot, M, table_size);
-                            if (taken.get(p)) break;
-                            positions.push_back(p);
-                        }
-
-                        if (bucket_begin == bucket_end) {
-                            std::sort(positions.begin(), positions.end());
-                            auto it = std::adjacent_find(positions.begin(), positions.end());
-                            if (it != positions.end()) continue;
-
-                            // I can stop the pilot search as there are not collisions
-                            pilot_checked = true;
+                if (pilot_checked and pilot != finder.bumped_pilot()) {
+                    // I already computed the positions and checked the in-bucket collisions
+                    // I must only check the bitmap again
+                    for (auto p : positions) {
+                        if (taken.get(p)) {
+                            pilot_checked = false;
+                            ++pilot;
                             break;
                         }
-                    } else {
-                        // I already computed the positions and checked the in-bucket collisions
-                        // I must only check the bitmap again
-                        for (auto p : positions) {
-                            if (taken.get(p)) {
-                                pilot_checked = false;
-                                break;
-                            }
-                        }
-                        // I can stop the pilot search as there are not collisions
-                        if (pilot_checked) break;
                     }
                 }
+                if (!pilot_checked) {
+                    pilot = finder.find(bucket, pilot, positions);
+                    pilot_checked = true;
+                }
 
                 // I am the first thread: this is the only condition that can stop the loop
                 if (local_next_bucket_idx == local_bucket_idx) break;
 
-                // active wait until another thread pushes a change in the bitmap
-                while (local_next_bucket_idx == next_bucket_idx)
-                    ;
+                // wait until another thread pushes a change in the bitmap
+                waiter.wait([&]() { return local_next_bucket_idx != next_bucket_idx or aborted; });
+                if (aborted) return;
             }
             assert(local_bucket_idx == next_bucket_idx);
 
             /* thread-safe from now on */
 
+            num_trials += pilot + 1;
             pilots.emplace_back(bucket.id(), pilot);
-            for (auto p : positions) {
-                assert(taken.get(p) == false);
-                taken.set(p, true);
+            if (pilot == finder.bumped_pilot()) {
+                for (uint64_t hash : bucket) bumped_keys.push_back({bucket.id(), hash, 0});
+            } else {
+                for (auto p : positions) {
+                    assert(taken.get(p) == false);
+                    taken.set(p, true);
+                }
             }
             if (config.verbose_output) log.update(local_bucket_idx, bucket.size(), pilot);
 
@@ -263,6 +467,7 @@ void search_parallel(uint64_t num_keys, uint64_t num_buckets, uint64_t num_non_e
             if (local_bucket_idx >= num_non_empty_buckets) {  // stop the thread
                 // update (global) next_bucket_idx, which may unlock other threads
                 ++next_bucket_idx;
+                waiter.notify();
                 break;
             }
 
@@ -272,41 +477,48 @@ void search_parallel(uint64_t num_keys, uint64_t num_buckets, uint64_t num_non_e
 
             // update (global) next_bucket_idx, which may unlock other threads
             ++next_bucket_idx;
+            waiter.notify();
         }
     };
 
-    std::vector<std::thread> threads;
-    threads.reserve(num_threads);
-    next_bucket_idx = static_cast<uint64_t>(-1);  // avoid that some thread advances the iterator
+    /* the first bucket of every thread is read before any thread advances the iterator */
+    std::vector<bucket_t> first_buckets;
+    first_buckets.reserve(num_threads);
     for (uint64_t i = 0; i != num_threads and i < num_non_empty_buckets; ++i, ++buckets) {
-        bucket_t bucket = *buckets;
-        threads.emplace_back(exe, i, bucket);
+        first_buckets.push_back(*buckets);
     }
 
-    next_bucket_idx = 0;  // notify the first thread
-    for (auto& t : threads) {
-        if (t.joinable()) t.join();
+    auto exe = [&](uint64_t local_bucket_idx) {
+        try {
+            search_buckets(local_bucket_idx, first_buckets[local_bucket_idx]);
+        } catch (...) {
+            exceptions[local_bucket_idx] = std::current_exception();
+            aborted = true;
+            waiter.notify();
+        }
+    };
+
+    run_parallel(config.pool, first_buckets.size(), exe);
+    for (auto const& e : exceptions) {
+        if (e) std::rethrow_exception(e);
     }
     assert(next_bucket_idx == num_non_empty_buckets);
 
     if (config.verbose_output) log.finalize(next_bucket_idx);
+    return num_trials;
 }
 
-template <typename BucketsIterator, typename PilotsBuffer>
-void search(uint64_t num_keys, uint64_t num_buckets, uint64_t num_non_empty_buckets, uint64_t seed,
-            build_configuration const& config, BucketsIterator& buckets,
-            bits::bit_vector::builder& taken, PilotsBuffer& pilots) {
+template <typename RangeReducer, typename BucketsIterator, typename PilotsBuffer>
+uint64_t search(uint64_t num_keys, uint64_t num_buckets, uint64_t num_non_empty_buckets,
+                uint64_t seed, build_configuration const& config, BucketsIterator& buckets,
+                bits::bit_vector::builder& taken, PilotsBuffer& pilots,
+                std::vector<bumped_key>& bumped_keys) {
     if (config.num_threads > 1) {
-        if (config.num_threads > std::thread::hardware_concurrency()) {
-            throw std::invalid_argument("parallel search should use at most " +
-                                        std::to_string(std::thread::hardware_concurrency()) +
-                                        " threads");
-        }
-        search_parallel(num_keys, num_buckets, num_non_empty_buckets, seed, config, buckets, taken,
-                        pilots);
+        return search_parallel<RangeReducer>(num_keys, num_buckets, num_non_empty_buckets, seed,
+                                             config, buckets, taken, pilots, bumped_keys);
     } else {
-        search_sequential(num_keys, num_buckets, num_non_empty_buckets, seed, config, buckets,
-                          taken, pilots);
+        return search_sequential<RangeReducer>(num_keys, num_buckets, num_non_empty_buckets, seed,
+                                               config, buckets, taken, pilots, bumped_keys);
     }
 }
 
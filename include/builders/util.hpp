@@ -2,9 +2,15 @@
 
 #include <fstream>
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <numeric>  // for iota
+#include <exception>  // for exception_ptr
+#include <type_traits>
 #include <cmath>  // for exp, log, lgamma
 
 #include "include/utils/logger.hpp"
+#include "include/utils/thread_pool.hpp"
 
 namespace pthash {
 
@@ -35,12 +41,21 @@ struct build_timings {
         : partitioning_seconds(0.0)
         , mapping_ordering_seconds(0.0)
         , searching_seconds(0.0)
-        , encoding_seconds(0.0) {}
+        , encoding_seconds(0.0)
+        , searching_trials(0) {}
 
     double partitioning_seconds;
     double mapping_ordering_seconds;
     double searching_seconds;
     double encoding_seconds;
+
+    /* Number of pilots tested by the search, i.e., the sum of all pilots + 1. */
+    uint64_t searching_trials;
+
+    /* Search throughput: pilots tested per second. */
+    double searching_trials_per_second() const {
+        return searching_seconds > 0.0 ? searching_trials / searching_seconds : 0.0;
+    }
 };
 
 struct build_configuration {
@@ -54,7 +69,11 @@ struct build_configuration {
         , ram(static_cast<double>(constants::available_ram) * 0.75)
         , tmp_dir(constants::default_tmp_dirname)
         , minimal_output(false)
-        , verbose_output(true) {}
+        , verbose_output(true)
+        , counting_sort(false)
+        , search_spin_count(1000)
+        , max_pilot(constants::unlimited_pilot)
+        , pool(nullptr) {}
 
     double c;
     double alpha;
@@ -66,6 +85,34 @@ struct build_configuration {
     std::string tmp_dir;
     bool minimal_output;
     bool verbose_output;
+
+    /*
+        Bucketize the keys with a counting sort over the bucket ids, instead of
+        sorting bucket-payload pairs (internal-memory construction only).
+    */
+    bool counting_sort;
+
+    /*
+        Number of rounds a thread of the parallel search spins, waiting for its turn,
+        before yielding the processor and then going to sleep.
+    */
+    uint64_t search_spin_count;
+
+    /*
+        Largest pilot tried for a bucket. The buckets for which no pilot <= max_pilot
+        works are bumped: they get pilot max_pilot + 1 and their keys are placed into
+        free slots recorded in a small table. Close to alpha = 1, this cuts the few
+        very large pilots that dominate both search time and pilot space.
+        It must be <= constants::unlimited_pilot (the default), so that max_pilot + 1
+        does not wrap around to pilot 0.
+    */
+    uint64_t max_pilot;
+
+    /*
+        Threads on which the parallel phases run, instead of creating their own (not owned).
+        A phase that needs more than pool->num_threads() threads creates its own.
+    */
+    thread_pool* pool;
 };
 
 struct seed_runtime_error : public std::runtime_error {
@@ -133,6 +180,114 @@ private:
     PairsRandomAccessIterator m_iterator;
 };
 
+/*
+    Call job(i) for every i < num_threads on num_threads concurrent threads and return
+    when all calls are done: on the threads of pool, if any and if it has enough threads,
+    or on new threads otherwise (also when called from a thread of the pool, which could
+    not wait for its own run). Exceptions are rethrown in the calling thread.
+*/
+template <typename Job>
+void run_parallel(thread_pool* pool, uint64_t num_threads, Job const& job) {
+    if (pool and num_threads <= pool->num_threads() and !pool->is_pool_thread()) {
+        pool->run(num_threads, job);
+        return;
+    }
+    std::vector<std::exception_ptr> errors(num_threads);
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    for (uint64_t i = 0; i != num_threads; ++i) {
+        threads.emplace_back([&, i]() {
+            try {
+                job(i);
+            } catch (...) { errors[i] = std::current_exception(); }
+        });
+    }
+    for (auto& t : threads) t.join();
+    for (auto const& error : errors) {
+        if (error) std::rethrow_exception(error);
+    }
+}
+
+/*
+    Sort the pairs by bucket id, then by payload, using num_threads threads.
+    Since bucket ids are smaller than num_buckets, a parallel LSD radix sort only
+    needs a few passes over the bits of the bucket ids; the payloads of each bucket,
+    which holds a few pairs on average, are then sorted by insertion sort.
+    Requires 32-bit bucket ids.
+*/
+template <typename Pairs>
+void radix_sort_pairs(Pairs& pairs, uint64_t num_buckets, uint64_t num_threads,
+                      thread_pool* pool) {
+    static_assert(sizeof(bucket_id_type) == sizeof(uint32_t));
+    constexpr uint64_t radix_bits = 11;
+    constexpr uint64_t radix = uint64_t(1) << radix_bits;
+    const uint64_t num_pairs = pairs.size();
+    if (num_pairs == 0) return;
+    if (num_threads > num_pairs) num_threads = num_pairs;
+    if (num_threads == 0) num_threads = 1;
+    const uint64_t chunk_size = (num_pairs + num_threads - 1) / num_threads;
+
+    auto run = [num_threads, pool](auto const& exe) {
+        if (num_threads == 1) {
+            exe(0);
+            return;
+        }
+        run_parallel(pool, num_threads, exe);
+    };
+
+    uint64_t num_bits = 1;
+    while (num_bits < 32 and (uint64_t(1) << num_bits) < num_buckets) ++num_bits;
+
+    Pairs tmp(num_pairs);
+    std::vector<uint64_t> counts(num_threads * radix);
+    for (uint64_t shift = 0; shift < num_bits; shift += radix_bits) {
+        auto digit = [shift](bucket_payload_pair const& pair) {
+            return (pair.bucket_id >> shift) & (radix - 1);
+        };
+        run([&](uint64_t tid) {
+            uint64_t* local_counts = counts.data() + tid * radix;
+            std::fill(local_counts, local_counts + radix, 0);
+            uint64_t end = std::min(num_pairs, (tid + 1) * chunk_size);
+            for (uint64_t i = tid * chunk_size; i < end; ++i) ++local_counts[digit(pairs[i])];
+        });
+        /* where every thread writes the pairs of every digit: digit-major, thread-minor */
+        for (uint64_t d = 0, sum = 0; d != radix; ++d) {
+            for (uint64_t tid = 0; tid != num_threads; ++tid) {
+                uint64_t count = counts[tid * radix + d];
+                counts[tid * radix + d] = sum;
+                sum += count;
+            }
+        }
+        run([&](uint64_t tid) {
+            uint64_t* local_offsets = counts.data() + tid * radix;
+            uint64_t end = std::min(num_pairs, (tid + 1) * chunk_size);
+            for (uint64_t i = tid * chunk_size; i < end; ++i) {
+                tmp[local_offsets[digit(pairs[i])]++] = pairs[i];
+            }
+        });
+        pairs.swap(tmp);
+    }
+
+    /* sort by payload within buckets: chunk boundaries are moved to the start of a bucket */
+    auto bucket_start = [&](uint64_t i) {
+        while (i > 0 and i < num_pairs and pairs[i].bucket_id == pairs[i - 1].bucket_id) ++i;
+        return std::min(i, num_pairs);
+    };
+    /* computed before sorting: a thread must not read the pairs that another one moves */
+    std::vector<uint64_t> starts(num_threads + 1);
+    for (uint64_t tid = 0; tid <= num_threads; ++tid) starts[tid] = bucket_start(tid * chunk_size);
+    run([&](uint64_t tid) {
+        uint64_t begin = starts[tid];
+        uint64_t end = starts[tid + 1];
+        for (uint64_t i = begin + 1; i < end; ++i) {
+            bucket_payload_pair pair = pairs[i];
+            uint64_t j = i;
+            for (; j > begin and pair < pairs[j - 1]; --j) pairs[j] = pairs[j - 1];
+            pairs[j] = pair;
+        }
+    });
+}
+
 template <typename Pairs, typename Merger>
 void merge_single_block(Pairs const& pairs, Merger& merger, bool verbose) {
     progress_logger logger(pairs.size(), " == merged ", " pairs", verbose);
@@ -251,6 +406,198 @@ void merge(std::vector<Pairs> const& pairs_blocks, Merger& merger, bool verbose)
     }
 }
 
+/* A contiguous range of a sorted block of pairs. */
+struct pairs_view {
+    typedef bucket_payload_pair const* const_iterator;
+
+    pairs_view(const_iterator begin, const_iterator end) : m_begin(begin), m_end(end) {}
+
+    inline const_iterator begin() const {
+        return m_begin;
+    }
+    inline const_iterator end() const {
+        return m_end;
+    }
+    inline bucket_payload_pair const& operator[](uint64_t pos) const {
+        return *(m_begin + pos);
+    }
+    inline uint64_t size() const {
+        return m_end - m_begin;
+    }
+
+private:
+    const_iterator m_begin, m_end;
+};
+
+/*
+    Return at most num_ranges - 1 increasing bucket ids that split the pairs of the
+    sorted blocks into ranges of about the same number of pairs. The splitters are
+    chosen among bucket ids sampled at evenly spaced positions of every block.
+*/
+template <typename Pairs>
+std::vector<bucket_id_type> select_splitters(std::vector<Pairs> const& pairs_blocks,
+                                             uint64_t num_ranges) {
+    constexpr uint64_t oversampling = 16;
+    std::vector<std::pair<bucket_id_type, double>> samples;  // (bucket id, weight)
+    double num_pairs = 0;
+    for (auto const& pairs : pairs_blocks) {
+        uint64_t size = pairs.size();
+        if (size == 0) continue;
+        uint64_t num_samples = std::min(size, num_ranges * oversampling);
+        double weight = static_cast<double>(size) / num_samples;
+        for (uint64_t i = 0; i != num_samples; ++i) {
+            samples.emplace_back(pairs[i * size / num_samples].bucket_id, weight);
+        }
+        num_pairs += size;
+    }
+    std::sort(samples.begin(), samples.end());
+
+    std::vector<bucket_id_type> splitters;
+    double cumulative_weight = 0;
+    uint64_t range = 1;
+    for (auto const& sample : samples) {
+        if (range == num_ranges) break;
+        if (cumulative_weight >= range * num_pairs / num_ranges) {
+            if (splitters.empty() or sample.first > splitters.back()) {
+                splitters.push_back(sample.first);
+            }
+            while (range != num_ranges and cumulative_weight >= range * num_pairs / num_ranges) {
+                ++range;
+            }
+        }
+        cumulative_weight += sample.second;
+    }
+    return splitters;
+}
+
+/*
+    Merge the sorted blocks with num_threads threads. The bucket ids are split into
+    ranges by select_splitters and every splitter is located in every block by binary
+    search, so that no bucket straddles two ranges and duplicates are still detected.
+    Then, each thread calls merge_range(range, offset, blocks) for its own range, where
+    offset is the number of pairs in the preceding ranges and blocks are the non-empty
+    pieces of the blocks that fall into the range (typically, merge_range merges them
+    with merge into a merger reserved to the range). Exceptions, e.g., seed_runtime_error
+    for duplicate pairs, are rethrown in the calling thread.
+*/
+template <typename Pairs, typename RangeMerger>
+void merge_parallel(std::vector<Pairs> const& pairs_blocks, uint64_t num_threads,
+                    thread_pool* pool, RangeMerger merge_range) {
+    const uint64_t num_blocks = pairs_blocks.size();
+    uint64_t num_pairs = 0;
+    for (auto const& pairs : pairs_blocks) num_pairs += pairs.size();
+    if (num_pairs == 0) return;
+    if (num_threads > num_pairs) num_threads = num_pairs;
+    if (num_threads == 0) num_threads = 1;
+
+    std::vector<bucket_id_type> splitters;
+    if (num_threads > 1) splitters = select_splitters(pairs_blocks, num_threads);
+    const uint64_t num_ranges = splitters.size() + 1;
+
+    /* the pairs of the r-th range in the b-th block are [cuts[b][r], cuts[b][r + 1]) */
+    std::vector<std::vector<uint64_t>> cuts(num_blocks, std::vector<uint64_t>(num_ranges + 1));
+    std::vector<bucket_payload_pair const*> data(num_blocks, nullptr);
+    for (uint64_t b = 0; b != num_blocks; ++b) {
+        uint64_t size = pairs_blocks[b].size();
+        if (size != 0) data[b] = &pairs_blocks[b][0];
+        for (uint64_t r = 0; r != splitters.size(); ++r) {
+            cuts[b][r + 1] = std::lower_bound(data[b], data[b] + size, splitters[r],
+                                              [](bucket_payload_pair const& pair,
+                                                 bucket_id_type bucket_id) {
+                                                  return pair.bucket_id < bucket_id;
+                                              }) -
+                             data[b];
+        }
+        cuts[b][num_ranges] = size;
+    }
+
+    auto exe = [&](uint64_t r) {
+        std::vector<pairs_view> blocks;
+        uint64_t offset = 0;
+        for (uint64_t b = 0; b != num_blocks; ++b) {
+            offset += cuts[b][r];
+            if (cuts[b][r] != cuts[b][r + 1]) {
+                blocks.emplace_back(data[b] + cuts[b][r], data[b] + cuts[b][r + 1]);
+            }
+        }
+        if (!blocks.empty()) merge_range(r, offset, blocks);
+    };
+
+    if (num_ranges == 1) {
+        exe(0);
+        return;
+    }
+
+    run_parallel(pool, num_ranges, exe);
+}
+
+/* Return the ids 0..sizes.size()-1 of some tasks by decreasing size of the task. */
+inline std::vector<uint64_t> largest_first(std::vector<uint64_t> const& sizes) {
+    std::vector<uint64_t> order(sizes.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+                     [&](uint64_t i, uint64_t j) { return sizes[i] > sizes[j]; });
+    return order;
+}
+
+/*
+    Call task(thread, id) for every id of order with num_threads threads. The threads
+    share the tasks through an atomic counter: a thread takes the next task of order as
+    soon as it is done with the previous one, so a thread that got small tasks takes more
+    of them. With the largest tasks first (see largest_first), the tasks left at the end
+    are short and the threads finish together. After an exception, no new task is taken;
+    the exception is rethrown in the calling thread.
+*/
+template <typename Task>
+void run_tasks(std::vector<uint64_t> const& order, uint64_t num_threads, thread_pool* pool,
+               Task task) {
+    const uint64_t num_tasks = order.size();
+    if (num_threads > num_tasks) num_threads = num_tasks;
+    if (num_threads <= 1) {
+        for (uint64_t id : order) task(0, id);
+        return;
+    }
+
+    std::atomic<uint64_t> next(0);
+    std::atomic<bool> failed(false);
+    run_parallel(pool, num_threads, [&](uint64_t t) {
+        try {
+            for (uint64_t i = next++; i < num_tasks and !failed; i = next++) task(t, order[i]);
+        } catch (...) {
+            failed = true;
+            throw;
+        }
+    });
+}
+
+/* A key of a bumped bucket (see build_configuration::max_pilot) and its slot. */
+struct bumped_key {
+    uint64_t bucket;
+    uint64_t payload;
+    uint64_t slot;
+
+    bool operator<(bumped_key const& other) const {
+        return bucket < other.bucket or (bucket == other.bucket and payload < other.payload);
+    }
+};
+
+/*
+    Sort the bumped keys by bucket and payload, assign them the first free slots of the
+    table in this order and mark the slots as taken: the slots increase with the keys.
+    As the search leaves at least as many free slots before num_keys as there are bumped
+    keys, the slots are all < num_keys.
+*/
+inline void place_bumped_keys(std::vector<bumped_key>& bumped_keys,
+                              bits::bit_vector::builder& taken) {
+    std::sort(bumped_keys.begin(), bumped_keys.end());
+    uint64_t slot = 0;
+    for (auto& key : bumped_keys) {
+        while (taken.get(slot)) ++slot;
+        key.slot = slot;
+        taken.set(slot, true);
+    }
+}
+
 template <typename FreeSlots>
 void fill_free_slots(bits::bit_vector::builder const& taken,    //
                      uint64_t num_keys, FreeSlots& free_slots)  //
@@ -288,6 +635,72 @@ void fill_free_slots(bits::bit_vector::builder const& taken,    //
     assert(next_used_slot == table_size);
 }
 
+/*
+    Whether the keys can be read from several threads: keys.split(num_keys, num_chunks)
+    returns at most num_chunks (iterator, number of keys) pairs that, in order, cover
+    the first num_keys keys.
+*/
+template <typename Iterator, typename = void>
+struct is_splittable : std::false_type {};
+
+template <typename Iterator>
+struct is_splittable<Iterator, std::void_t<decltype(std::declval<Iterator const&>().split(
+                                   uint64_t(0), uint64_t(0)))>> : std::true_type {};
+
+/*
+    The number of threads that hash_keys uses to hash the first num_keys keys: the
+    consumer is called with thread ids smaller than this number.
+*/
+template <typename Iterator>
+uint64_t num_hashing_threads(uint64_t num_keys, uint64_t num_threads) {
+    if constexpr (is_splittable<Iterator>::value) {
+        if (num_threads > 1 and num_keys >= num_threads) return num_threads;
+    }
+    (void)num_keys;  // avoid unused warning for non-splittable iterators
+    return 1;
+}
+
+/*
+    Hash the first num_keys keys and pass the hashes to consume(tid, hashes, n) in blocks.
+    If the keys are splittable, each of the num_threads threads hashes its own chunk of
+    the input and calls consume with its own tid, so that consume can keep per-thread
+    state without locking: calls with different tids run concurrently, calls with the
+    same tid never do.
+*/
+template <typename Hasher, typename Iterator, typename Consumer>
+void hash_keys(Iterator keys, uint64_t num_keys, uint64_t seed, uint64_t num_threads,
+               thread_pool* pool, Consumer consume) {
+    typedef typename Hasher::hash_type hash_type;
+    constexpr uint64_t block_size = 4096;
+
+    auto hash_chunk = [&](uint64_t tid, Iterator it, uint64_t n) {
+        std::vector<hash_type> hashes;
+        hashes.reserve(std::min(n, block_size));
+        for (uint64_t i = 0; i != n; ++i, ++it) {
+            auto const& key = *it;
+            hashes.push_back(Hasher::hash(key, seed));
+            if (hashes.size() == block_size) {
+                consume(tid, hashes.data(), hashes.size());
+                hashes.clear();
+            }
+        }
+        if (!hashes.empty()) consume(tid, hashes.data(), hashes.size());
+    };
+
+    if constexpr (is_splittable<Iterator>::value) {
+        if (num_hashing_threads<Iterator>(num_keys, num_threads) > 1) {
+            auto chunks = keys.split(num_keys, num_threads);
+            assert(chunks.size() <= num_threads);
+            run_parallel(pool, chunks.size(), [&](uint64_t i) {
+                hash_chunk(i, chunks[i].first, chunks[i].second);
+            });
+            return;
+        }
+    }
+
+    hash_chunk(0, keys, num_keys);
+}
+
 template <typename RandomAccessIterator, typename Hasher>
 struct hash_generator {
     hash_generator(RandomAccessIterator keys, uint64_t seed) : m_iterator(keys), m_seed(seed) {}
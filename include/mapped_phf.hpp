@@ -0,0 +1,918 @@
+#pragma once
+
+#include <fstream>
+
+#include "external/mm_file/include/mm_file/mm_file.hpp"
+
+#include "include/single_phf.hpp"
+#include "include/partitioned_phf.hpp"
+
+namespace pthash {
+
+/*
+    Flat format for memory-mapped functions.
+
+    The file is an array of 64-bit words, so that every field is 8-byte aligned
+    in the mapping and can be read in place: opening a view does not copy any
+    pilot or free slot, and several processes can share the page cache.
+
+    Header (padded to 16 words, so that the directory entries are cache-aligned):
+        [magic] [version] [flags] [hash_bits] [range_reducer] [encoder] [entry_words]
+        [seed] [num_keys] [table_size] [num_partitions] [num_words]
+    The words are in the byte order of the machine that wrote the file: on a machine
+    with the other byte order, the magic word reads byte-swapped and the file is refused.
+
+    Directory (a single function has one partition): one entry of entry_words words for
+    each partition, with the constants read by a lookup before the pilots, written field
+    by field (see directory_entry). Then the data of each partition, at the positions
+    given by its entry:
+        [pilots: the arrays of the encoder (see pilots_view)]
+        [free slots: Elias-Fano (see elias_fano_view)]
+        [num_bumped_keys] [num_bumped_buckets] [fingerprint_bits]
+        [bumped buckets: num_bumped_buckets bucket ids, then num_bumped_buckets + 1
+         offsets of their first keys, then the fingerprint_bits-bit fingerprints and
+         the slots of the num_bumped_keys keys, all with fixed width]
+*/
+
+namespace mapped {
+
+constexpr uint64_t magic = 0x4d4d485341485450;  // "PTHASHMM"
+constexpr uint64_t version = 6;
+constexpr uint64_t header_words = 16;
+constexpr uint64_t bumped_header_words = 3;
+
+constexpr uint64_t minimal_flag = 1;
+constexpr uint64_t partitioned_flag = 2;
+
+inline uint64_t num_bits_for(uint64_t x) {
+    return x == 0 ? 0 : 64 - __builtin_clzll(x);
+}
+
+inline uint64_t num_words_for(uint64_t n, uint64_t width) {
+    return (n * width + 63) / 64;
+}
+
+/* FNV-1a of the name of a type, stable across compilers */
+inline uint64_t name_tag(std::string const& name) {
+    uint64_t tag = 0xcbf29ce484222325;
+    for (char c : name) tag = (tag ^ static_cast<uint8_t>(c)) * 0x100000001b3;
+    return tag;
+}
+
+/* The width-bit value that starts at bit position of data. */
+inline uint64_t get_bits(uint64_t const* data, uint64_t position, uint64_t width) {
+    if (width == 0) return 0;  // no word is stored for 0-bit values
+    uint64_t mask = width == 64 ? uint64_t(-1) : (uint64_t(1) << width) - 1;
+    uint64_t block = position >> 6;
+    uint64_t shift = position & 63;
+    if (shift + width <= 64) return (data[block] >> shift) & mask;
+    return ((data[block] >> shift) | (data[block + 1] << (64 - shift))) & mask;
+}
+
+/* Fixed-width values stored in the mapping. */
+struct packed_view {
+    packed_view() : m_data(nullptr), m_width(0) {}
+
+    void init(uint64_t const* data, uint64_t width) {
+        m_data = data;
+        m_width = width;
+    }
+
+    inline uint64_t access(uint64_t i) const {
+        return get_bits(m_data, i * m_width, m_width);
+    }
+
+private:
+    uint64_t const* m_data;
+    uint64_t m_width;
+};
+
+template <typename Iterator>
+void append_packed(std::vector<uint64_t>& words, Iterator values, uint64_t n, uint64_t width) {
+    if (width == 0) return;  // all the values are 0
+    uint64_t begin = words.size();
+    words.resize(begin + num_words_for(n, width), 0);
+    uint64_t* data = words.data() + begin;
+    for (uint64_t i = 0, pos = 0; i != n; ++i, ++values, pos += width) {
+        uint64_t value = *values;
+        uint64_t block = pos >> 6;
+        uint64_t shift = pos & 63;
+        data[block] |= value << shift;
+        if (shift + width > 64) data[block + 1] |= value >> (64 - shift);
+    }
+}
+
+/*
+    Visitors that write, read and count the fields of a structure as consecutive words
+    (the reducers and the views below only have uint64_t fields): the file does not
+    depend on how the compiler lays out the structures.
+*/
+struct words_writer {
+    words_writer(uint64_t* words) : m_words(words) {}
+
+    void visit(uint64_t x) {
+        *m_words++ = x;
+    }
+
+    template <typename T>
+    void visit(T const& t) {
+        t.visit(*this);
+    }
+
+private:
+    uint64_t* m_words;
+};
+
+struct words_reader {
+    words_reader(uint64_t const* words) : m_words(words) {}
+
+    void visit(uint64_t& x) {
+        x = *m_words++;
+    }
+
+    template <typename T>
+    void visit(T& t) {
+        t.visit(*this);
+    }
+
+private:
+    uint64_t const* m_words;
+};
+
+struct words_counter {
+    words_counter() : num_words(0) {}
+
+    void visit(uint64_t) {
+        ++num_words;
+    }
+
+    template <typename T>
+    void visit(T const& t) {
+        t.visit(*this);
+    }
+
+    uint64_t num_words;
+};
+
+/* Fixed-width values from word data of the file, in the layout of bits::compact_vector. */
+struct compact_view {
+    compact_view() : data(0), width(0) {}
+
+    inline uint64_t access(uint64_t const* file, uint64_t i) const {
+        return get_bits(file + data, i * width, width);
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) const {
+        visit_impl(visitor, *this);
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) {
+        visit_impl(visitor, *this);
+    }
+
+    uint64_t data;
+    uint64_t width;
+
+private:
+    template <typename Visitor, typename T>
+    static void visit_impl(Visitor& visitor, T&& t) {
+        visitor.visit(t.data);
+        visitor.visit(t.width);
+    }
+};
+
+/*
+    Append the values of a compact_vector to words, whose first word is at position
+    first_word in the file: its words are copied as they are.
+*/
+inline compact_view append_compact(std::vector<uint64_t>& words, uint64_t first_word,
+                                   bits::compact_vector const& values) {
+    compact_view view;
+    view.data = first_word + words.size();
+    view.width = values.width();
+    uint64_t const* data = values.data().data();
+    words.insert(words.end(), data, data + num_words_for(values.size(), view.width));
+    return view;
+}
+
+/* Append n values with the fewest bits that fit the largest one. */
+template <typename Iterator>
+compact_view append_compact(std::vector<uint64_t>& words, uint64_t first_word, Iterator values,
+                            uint64_t n) {
+    uint64_t max_value = 0;
+    auto it = values;
+    for (uint64_t i = 0; i != n; ++i, ++it) max_value = std::max<uint64_t>(max_value, *it);
+    compact_view view;
+    view.data = first_word + words.size();
+    view.width = num_bits_for(max_value);
+    append_packed(words, values, n, view.width);
+    return view;
+}
+
+/*
+    A non-decreasing sequence with Elias-Fano, from word data of the file: the low_width
+    low bits of each value, then the high bits in unary (a 1 at position (x >> low_width)
+    + i for the i-th value x), then the position of every sampling-th 1, from which select
+    scans the high bits a word at a time.
+*/
+struct elias_fano_view {
+    static constexpr uint64_t sampling = 64;
+
+    elias_fano_view() : data(0), size(0), low_width(0), num_high_bits(0) {}
+
+    inline uint64_t access(uint64_t const* file, uint64_t i) const {
+        return ((select(file, i) - i) << low_width) | low(file, i);
+    }
+
+    /* Return access(i + 1) - access(i), with the second 1 found after the first one. */
+    inline uint64_t diff(uint64_t const* file, uint64_t i) const {
+        uint64_t const* high = file + data + num_words_for(size, low_width);
+        uint64_t position = select(file, i);
+        uint64_t block = position >> 6;
+        uint64_t word = high[block] & (uint64_t(-2) << (position & 63));
+        while (word == 0) word = high[++block];
+        uint64_t next = block * 64 + __builtin_ctzll(word);
+        return (((next - i - 1) << low_width) | low(file, i + 1)) -
+               (((position - i) << low_width) | low(file, i));
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) const {
+        visit_impl(visitor, *this);
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) {
+        visit_impl(visitor, *this);
+    }
+
+    uint64_t data;
+    uint64_t size;
+    uint64_t low_width;
+    uint64_t num_high_bits;
+
+private:
+    inline uint64_t low(uint64_t const* file, uint64_t i) const {
+        return get_bits(file + data, i * low_width, low_width);
+    }
+
+    /* Position of the i-th 1 of the high bits. */
+    inline uint64_t select(uint64_t const* file, uint64_t i) const {
+        uint64_t const* high = file + data + num_words_for(size, low_width);
+        uint64_t const* samples = high + num_words_for(num_high_bits, 1);
+        uint64_t sample_width = num_bits_for(num_high_bits);
+        uint64_t position = get_bits(samples, (i / sampling) * sample_width, sample_width);
+        uint64_t k = i % sampling;
+        uint64_t block = position >> 6;
+        uint64_t word = high[block] & (uint64_t(-1) << (position & 63));
+        for (uint64_t ones = __builtin_popcountll(word); k >= ones;
+             ones = __builtin_popcountll(word)) {
+            k -= ones;
+            word = high[++block];
+        }
+        for (; k != 0; --k) word &= word - 1;  // clear the k lowest 1s
+        return block * 64 + __builtin_ctzll(word);
+    }
+
+    template <typename Visitor, typename T>
+    static void visit_impl(Visitor& visitor, T&& t) {
+        visitor.visit(t.data);
+        visitor.visit(t.size);
+        visitor.visit(t.low_width);
+        visitor.visit(t.num_high_bits);
+    }
+};
+
+template <typename Iterator>
+elias_fano_view append_elias_fano(std::vector<uint64_t>& words, uint64_t first_word,
+                                  Iterator values, uint64_t n) {
+    elias_fano_view view;
+    view.data = first_word + words.size();
+    view.size = n;
+    if (n == 0) return view;
+    std::vector<uint64_t> sequence(n);
+    for (uint64_t i = 0; i != n; ++i, ++values) sequence[i] = *values;
+    uint64_t universe = sequence.back() + 1;
+    view.low_width = universe > n ? num_bits_for(universe / n) - 1 : 0;
+    view.num_high_bits = n + (sequence.back() >> view.low_width) + 1;
+    uint64_t low_mask = (uint64_t(1) << view.low_width) - 1;
+    std::vector<uint64_t> low(n), samples;
+    std::vector<uint64_t> high(num_words_for(view.num_high_bits, 1), 0);
+    for (uint64_t i = 0; i != n; ++i) {
+        assert(i == 0 or sequence[i] >= sequence[i - 1]);
+        low[i] = sequence[i] & low_mask;
+        uint64_t position = (sequence[i] >> view.low_width) + i;
+        high[position >> 6] |= uint64_t(1) << (position & 63);
+        if (i % elias_fano_view::sampling == 0) samples.push_back(position);
+    }
+    append_packed(words, low.begin(), n, view.low_width);
+    words.insert(words.end(), high.begin(), high.end());
+    append_packed(words, samples.begin(), samples.size(), num_bits_for(view.num_high_bits));
+    return view;
+}
+
+/* A dictionary: the rank of the pilot of each bucket, then the distinct pilots. */
+struct dictionary_view {
+    inline uint64_t access(uint64_t const* file, uint64_t i) const {
+        return dict.access(file, ranks.access(file, i));
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) const {
+        visit_impl(visitor, *this);
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) {
+        visit_impl(visitor, *this);
+    }
+
+    compact_view ranks;
+    compact_view dict;
+
+private:
+    template <typename Visitor, typename T>
+    static void visit_impl(Visitor& visitor, T&& t) {
+        visitor.visit(t.ranks);
+        visitor.visit(t.dict);
+    }
+};
+
+/*
+    The pilots of a partition in the mapping. access() returns what Encoder::access()
+    returns, and write() appends the pilots to words and sets the view. The encoders
+    made of flat arrays of fixed-width values (compact, partitioned_compact, dictionary
+    and their dual combinations) keep their layout: their words are copied as they are.
+    elias_fano is written as its prefix sums (see elias_fano_view) and the other
+    encoders (sdc, say) as a dictionary.
+*/
+template <typename Encoder>
+struct pilots_view : dictionary_view {
+    void write(std::vector<uint64_t>& words, uint64_t first_word, Encoder const& pilots,
+               uint64_t num_buckets) {
+        std::vector<uint64_t> values(num_buckets);
+        for (uint64_t i = 0; i != num_buckets; ++i) values[i] = pilots.access(i);
+        auto [rank_values, dict_values] = compute_ranks_and_dictionary(values.begin(), num_buckets);
+        ranks = append_compact(words, first_word, rank_values.begin(), rank_values.size());
+        dict = append_compact(words, first_word, dict_values.begin(), dict_values.size());
+    }
+};
+
+template <>
+struct pilots_view<dictionary> : dictionary_view {
+    void write(std::vector<uint64_t>& words, uint64_t first_word, dictionary const& pilots,
+               uint64_t) {
+        ranks = append_compact(words, first_word, pilots.ranks());
+        dict = append_compact(words, first_word, pilots.dict());
+    }
+};
+
+template <>
+struct pilots_view<hashed_dictionary> : pilots_view<dictionary> {};
+
+template <>
+struct pilots_view<compact> {
+    void write(std::vector<uint64_t>& words, uint64_t first_word, compact const& pilots,
+               uint64_t) {
+        values = append_compact(words, first_word, pilots.values());
+    }
+
+    inline uint64_t access(uint64_t const* file, uint64_t i) const {
+        return values.access(file, i);
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) const {
+        visitor.visit(values);
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) {
+        visitor.visit(values);
+    }
+
+    compact_view values;
+};
+
+/* The cumulative widths as 32-bit values, then the words of the bit_vector as they are. */
+template <>
+struct pilots_view<partitioned_compact> {
+    pilots_view() : bits_per_value(0), values(0) {}
+
+    void write(std::vector<uint64_t>& words, uint64_t first_word,
+               partitioned_compact const& pilots, uint64_t) {
+        auto const& widths = pilots.bits_per_value();
+        bits_per_value = first_word + words.size();
+        append_packed(words, widths.begin(), widths.size(), 32);
+        values = first_word + words.size();
+        auto const& data = pilots.values().data();
+        words.insert(words.end(), data.data(), data.data() + data.size());
+    }
+
+    inline uint64_t access(uint64_t const* file, uint64_t i) const {
+        uint64_t partition = i / partitioned_compact::partition_size;
+        uint64_t offset = i % partitioned_compact::partition_size;
+        uint64_t widths = get_bits(file + bits_per_value, 32 * partition, 64);
+        uint64_t begin = widths & uint32_t(-1);
+        uint64_t num_bits = (widths >> 32) - begin;
+        return get_bits(file + values, begin * partitioned_compact::partition_size +
+                                            offset * num_bits,
+                        num_bits);
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) const {
+        visit_impl(visitor, *this);
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) {
+        visit_impl(visitor, *this);
+    }
+
+    uint64_t bits_per_value;
+    uint64_t values;
+
+private:
+    template <typename Visitor, typename T>
+    static void visit_impl(Visitor& visitor, T&& t) {
+        visitor.visit(t.bits_per_value);
+        visitor.visit(t.values);
+    }
+};
+
+template <>
+struct pilots_view<elias_fano> {
+    void write(std::vector<uint64_t>& words, uint64_t first_word, elias_fano const& pilots,
+               uint64_t num_buckets) {
+        std::vector<uint64_t> sums(num_buckets + 1, 0);
+        for (uint64_t i = 0; i != num_buckets; ++i) sums[i + 1] = sums[i] + pilots.access(i);
+        values = append_elias_fano(words, first_word, sums.begin(), sums.size());
+    }
+
+    inline uint64_t access(uint64_t const* file, uint64_t i) const {
+        return values.diff(file, i);
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) const {
+        visitor.visit(values);
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) {
+        visitor.visit(values);
+    }
+
+    elias_fano_view values;
+};
+
+template <typename Front, typename Back>
+struct pilots_view<dual<Front, Back>> {
+    pilots_view() : front_size(0) {}
+
+    void write(std::vector<uint64_t>& words, uint64_t first_word,
+               dual<Front, Back> const& pilots, uint64_t num_buckets) {
+        front_size = pilots.front().size();
+        front.write(words, first_word, pilots.front(), front_size);
+        back.write(words, first_word, pilots.back(), num_buckets - front_size);
+    }
+
+    inline uint64_t access(uint64_t const* file, uint64_t i) const {
+        if (i < front_size) return front.access(file, i);
+        return back.access(file, i - front_size);
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) const {
+        visit_impl(visitor, *this);
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) {
+        visit_impl(visitor, *this);
+    }
+
+    uint64_t front_size;
+    pilots_view<Front> front;
+    pilots_view<Back> back;
+
+private:
+    template <typename Visitor, typename T>
+    static void visit_impl(Visitor& visitor, T&& t) {
+        visitor.visit(t.front_size);
+        visitor.visit(t.front);
+        visitor.visit(t.back);
+    }
+};
+
+/*
+    The constants of a partition, as the partition headers of partitioned_phf: a lookup
+    reads one entry and does not compute any constant of the reducers again (a 128-bit
+    division each for fastmod_reducer). The views of the pilots and of the free slots
+    give the positions of their data in the file. An entry is written and read field
+    by field, as words (see words_writer).
+*/
+template <typename RangeReducer, typename Encoder>
+struct directory_entry {
+    directory_entry()
+        : offset(0), seed(0), num_keys(0), bumped_hashed_pilot(0), bumped_keys(0) {}
+
+    /* The number of words of an entry in the file, padded to whole cache lines. */
+    static uint64_t num_words() {
+        words_counter counter;
+        counter.visit(directory_entry());
+        return (counter.num_words + 7) / 8 * 8;
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) const {
+        visit_impl(visitor, *this);
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) {
+        visit_impl(visitor, *this);
+    }
+
+    skew_bucketer<RangeReducer> bucketer;
+    RangeReducer table;
+    pilots_view<Encoder> pilots;
+    uint64_t offset;  // position of the first slot of the partition
+    uint64_t seed;
+    uint64_t num_keys;
+    uint64_t bumped_hashed_pilot;
+    elias_fano_view free_slots;
+    uint64_t bumped_keys;  // position of the bumped keys in the file
+
+private:
+    template <typename Visitor, typename T>
+    static void visit_impl(Visitor& visitor, T&& t) {
+        visitor.visit(t.bucketer);
+        visitor.visit(t.table);
+        visitor.visit(t.pilots);
+        visitor.visit(t.offset);
+        visitor.visit(t.seed);
+        visitor.visit(t.num_keys);
+        visitor.visit(t.bumped_hashed_pilot);
+        visitor.visit(t.free_slots);
+        visitor.visit(t.bumped_keys);
+    }
+};
+
+/*
+    Append the data of a single function (or of a partition) to words, whose first
+    word is at position first_word in the file, and return its directory entry.
+*/
+template <typename RangeReducer, typename Encoder, typename Function>
+directory_entry<RangeReducer, Encoder> append_partition(std::vector<uint64_t>& words,
+                                                        uint64_t first_word, Function const& f,
+                                                        uint64_t offset) {
+    uint64_t num_buckets = f.num_buckets();
+    uint64_t num_free_slots = Function::minimal ? f.table_size() - f.num_keys() : 0;
+
+    directory_entry<RangeReducer, Encoder> entry;
+    entry.bucketer.init(num_buckets);
+    entry.table.init(f.table_size());
+    entry.offset = offset;
+    entry.seed = f.seed();
+    entry.num_keys = f.num_keys();
+    entry.bumped_hashed_pilot = f.bumped_hashed_pilot();
+
+    entry.pilots.write(words, first_word, f.pilots(), num_buckets);
+
+    std::vector<uint64_t> free_slots(num_free_slots);
+    for (uint64_t i = 0; i != num_free_slots; ++i) free_slots[i] = f.free_slot(i);
+    entry.free_slots = append_elias_fano(words, first_word, free_slots.begin(), num_free_slots);
+
+    auto const& bumped = f.bumped_keys();
+    auto bumped_keys = bumped.keys();
+    uint64_t num_bumped_keys = bumped_keys.size();
+    std::vector<uint64_t> bumped_buckets, bumped_offsets, fingerprints, slots;
+    for (uint64_t i = 0; i != num_bumped_keys; ++i) {
+        auto const& k = bumped_keys[i];
+        if (i == 0 or k.bucket != bumped_keys[i - 1].bucket) {
+            bumped_buckets.push_back(k.bucket);
+            bumped_offsets.push_back(i);
+        }
+        fingerprints.push_back(k.payload);
+        slots.push_back(k.slot);
+    }
+    bumped_offsets.push_back(num_bumped_keys);
+    uint64_t num_bumped_buckets = bumped_buckets.size();
+
+    entry.bumped_keys = first_word + words.size();
+    words.push_back(num_bumped_keys);
+    words.push_back(num_bumped_buckets);
+    words.push_back(bumped.fingerprint_bits());
+    append_packed(words, bumped_buckets.begin(), num_bumped_buckets,
+                  num_bits_for(num_buckets - 1));
+    append_packed(words, bumped_offsets.begin(), num_bumped_buckets + 1,
+                  num_bits_for(num_bumped_keys));
+    append_packed(words, fingerprints.begin(), num_bumped_keys, bumped.fingerprint_bits());
+    append_packed(words, slots.begin(), num_bumped_keys, num_bits_for(f.table_size() - 1));
+    return entry;
+}
+
+/* A single function (or a partition) whose pilots and free slots live in the mapping. */
+template <typename Hasher, typename Encoder, bool Minimal, typename RangeReducer>
+struct partition_view {
+    partition_view() {}
+
+    /* Read the directory entry at entry[0] of the file starting at file[0]. */
+    partition_view(uint64_t const* file, uint64_t const* entry) : m_file(file) {
+        words_reader reader(entry);
+        reader.visit(m_entry);
+    }
+
+    inline uint64_t position(typename Hasher::hash_type hash) const {
+        uint64_t bucket = m_entry.bucketer.bucket(hash.first());
+        uint64_t hashed_pilot = this->hashed_pilot(bucket);
+        if (PTHASH_LIKELY(hashed_pilot != m_entry.bumped_hashed_pilot)) {
+            uint64_t p = m_entry.table.reduce(hash.second() ^ hashed_pilot);
+            if constexpr (Minimal) {
+                if (PTHASH_LIKELY(p < m_entry.num_keys)) return p;
+                return m_entry.free_slots.access(m_file, p - m_entry.num_keys);
+            }
+            return p;
+        }
+        return bumped_slot(bucket, hash.second());
+    }
+
+    inline uint64_t offset() const {
+        return m_entry.offset;
+    }
+
+    inline uint64_t seed() const {
+        return m_entry.seed;
+    }
+
+    inline uint64_t num_keys() const {
+        return m_entry.num_keys;
+    }
+
+    inline uint64_t table_size() const {
+        return m_entry.table.range();
+    }
+
+private:
+    inline uint64_t hashed_pilot(uint64_t bucket) const {
+        uint64_t value = m_entry.pilots.access(m_file, bucket);
+        if constexpr (stores_hashed_pilots<Encoder>::value) return value;
+        return default_hash64(value, m_entry.seed);
+    }
+
+    uint64_t bumped_slot(uint64_t bucket, uint64_t payload) const {
+        uint64_t const* words = m_file + m_entry.bumped_keys;
+        uint64_t num_keys = words[0];
+        uint64_t num_buckets = words[1];
+        uint64_t fingerprint_bits = words[2];
+        uint64_t buckets_width = num_bits_for(m_entry.bucketer.num_buckets() - 1);
+        uint64_t offsets_width = num_bits_for(num_keys);
+        packed_view buckets, offsets, fingerprints, slots;
+        words += bumped_header_words;
+        buckets.init(words, buckets_width);
+        words += num_words_for(num_buckets, buckets_width);
+        offsets.init(words, offsets_width);
+        words += num_words_for(num_buckets + 1, offsets_width);
+        fingerprints.init(words, fingerprint_bits);
+        words += num_words_for(num_keys, fingerprint_bits);
+        slots.init(words, num_bits_for(table_size() - 1));
+        return pthash::bumped_slot(buckets, offsets, fingerprints, slots, num_buckets,
+                                   fingerprint_bits, bucket, payload);
+    }
+
+    uint64_t const* m_file;
+    directory_entry<RangeReducer, Encoder> m_entry;
+};
+
+/*
+    Writes the header, then the data of the partitions one at a time; the number of
+    words of the file and the directory are filled in by close().
+*/
+template <typename Hasher, typename Encoder, bool Minimal, typename RangeReducer>
+struct writer {
+    writer(std::string const& filename, uint64_t seed, uint64_t num_keys, uint64_t table_size,
+           uint64_t num_partitions, bool partitioned)
+        : m_out(filename.c_str(), std::ofstream::binary)
+        , m_header(header_words, 0)
+        , m_entry_words(directory_entry<RangeReducer, Encoder>::num_words())
+        , m_directory(m_entry_words * num_partitions, 0) {
+        if (!m_out.is_open()) throw std::runtime_error("cannot open file");
+        m_header[0] = magic;
+        m_header[1] = version;
+        m_header[2] = (Minimal ? minimal_flag : 0) | (partitioned ? partitioned_flag : 0);
+        m_header[3] = 8 * sizeof(typename Hasher::hash_type);
+        m_header[4] = name_tag(RangeReducer::name());
+        m_header[5] = name_tag(Encoder::name());
+        m_header[6] = m_entry_words;
+        m_header[7] = seed;
+        m_header[8] = num_keys;
+        m_header[9] = table_size;
+        m_header[10] = num_partitions;
+        write(m_header);
+        write(m_directory);
+        m_num_words = m_header.size() + m_directory.size();
+    }
+
+    template <typename Function>
+    void append_partition(uint64_t i, Function const& f, uint64_t offset) {
+        m_words.clear();
+        auto entry =
+            mapped::append_partition<RangeReducer, Encoder>(m_words, m_num_words, f, offset);
+        words_writer entry_writer(m_directory.data() + m_entry_words * i);
+        entry_writer.visit(entry);
+        write(m_words);
+        m_num_words += m_words.size();
+    }
+
+    void close() {
+        m_header[11] = m_num_words;
+        m_out.seekp(0);
+        write(m_header);
+        write(m_directory);
+        m_out.close();
+    }
+
+private:
+    void write(std::vector<uint64_t> const& words) {
+        m_out.write(reinterpret_cast<char const*>(words.data()), words.size() * sizeof(uint64_t));
+    }
+
+    std::ofstream m_out;
+    std::vector<uint64_t> m_header;
+    uint64_t m_entry_words;
+    std::vector<uint64_t> m_directory;
+    std::vector<uint64_t> m_words;
+    uint64_t m_num_words;
+};
+
+/*
+    Check the header of a mapped file and the number of its words: a file that was
+    cut short is refused when opened, as the data of its partitions is only read by
+    the lookups.
+*/
+template <typename Hasher, typename Encoder, bool Minimal, typename RangeReducer>
+void check_header(mm::file_source<uint64_t> const& file, bool partitioned) {
+    if (!file.is_open()) throw std::runtime_error("cannot open file");
+    uint64_t const* header = file.data();
+    if (file.size() >= header_words and header[0] == __builtin_bswap64(magic)) {
+        throw std::runtime_error("the file was written with a different byte order");
+    }
+    if (file.size() < header_words or header[0] != magic) {
+        throw std::runtime_error("not a mapped pthash file");
+    }
+    if (header[1] != version) throw std::runtime_error("unsupported mapped file version");
+    uint64_t expected_flags =
+        (Minimal ? minimal_flag : 0) | (partitioned ? partitioned_flag : 0);
+    if (header[2] != expected_flags or header[3] != 8 * sizeof(typename Hasher::hash_type) or
+        header[4] != name_tag(RangeReducer::name()) or header[5] != name_tag(Encoder::name())) {
+        throw std::runtime_error("the file was written by a different type of function");
+    }
+    uint64_t entry_words = directory_entry<RangeReducer, Encoder>::num_words();
+    if (header[6] != entry_words) {
+        throw std::runtime_error("the directory entries of the file have a different layout");
+    }
+    uint64_t num_partitions = header[10];
+    if (header[11] != file.size() or header_words + entry_words * num_partitions > file.size()) {
+        throw std::runtime_error("truncated file");
+    }
+}
+
+}  // namespace mapped
+
+/*
+    Write a single_phf in the flat format read by single_phf_view.
+
+    The pilots are written in the layout of the encoder of f (see mapped::pilots_view),
+    and the free slots with Elias-Fano as in memory: the file takes about f.num_bits()
+    (2.2 to 2.8 bits/key with 2M keys and alpha = 0.97), a bit more for the encoders
+    written as a dictionary (2.6 bits/key for sdc, against 2.46 in memory).
+*/
+template <typename Hasher, typename Encoder, bool Minimal, typename RangeReducer>
+void save_mapped(single_phf<Hasher, Encoder, Minimal, RangeReducer> const& f,
+                 std::string const& filename) {
+    mapped::writer<Hasher, Encoder, Minimal, RangeReducer> out(filename, f.seed(), f.num_keys(),
+                                                               f.table_size(), 1, false);
+    out.append_partition(0, f, 0);
+    out.close();
+}
+
+/*
+    Write a partitioned_phf in the flat format read by partitioned_phf_view.
+    Each partition is written as a single_phf (see above), with a directory entry of
+    its own: the file takes about f.num_bits() as well (2.4 to 3.0 bits/key with
+    partitions of 10000 keys and alpha = 0.97).
+*/
+template <typename Hasher, typename Encoder, bool Minimal, typename RangeReducer>
+void save_mapped(partitioned_phf<Hasher, Encoder, Minimal, RangeReducer> const& f,
+                 std::string const& filename) {
+    uint64_t num_partitions = f.num_partitions();
+    mapped::writer<Hasher, Encoder, Minimal, RangeReducer> out(
+        filename, f.seed(), f.num_keys(), f.table_size(), num_partitions, true);
+    for (uint64_t i = 0; i != num_partitions; ++i) {
+        out.append_partition(i, f.partition_function(i), f.partition_offset(i));
+    }
+    out.close();
+}
+
+/*
+    Read-only single_phf running queries directly over the mapping of a file
+    written by save_mapped. Opening the view is O(1): nothing is loaded in memory.
+*/
+template <typename Hasher, typename Encoder, bool Minimal, typename RangeReducer = fastmod_reducer>
+struct single_phf_view {
+    single_phf_view(std::string const& filename) : m_file(filename, mm::advice::random) {
+        mapped::check_header<Hasher, Encoder, Minimal, RangeReducer>(m_file, false);
+        m_function = mapped::partition_view<Hasher, Encoder, Minimal, RangeReducer>(
+            m_file.data(), m_file.data() + mapped::header_words);
+    }
+
+    single_phf_view(single_phf_view const&) = delete;
+    single_phf_view& operator=(single_phf_view const&) = delete;
+
+    template <typename T>
+    uint64_t operator()(T const& key) const {
+        auto hash = Hasher::hash(key, seed());
+        return position(hash);
+    }
+
+    uint64_t position(typename Hasher::hash_type hash) const {
+        return m_function.position(hash);
+    }
+
+    inline uint64_t num_keys() const {
+        return m_function.num_keys();
+    }
+
+    inline uint64_t table_size() const {
+        return m_function.table_size();
+    }
+
+    inline uint64_t seed() const {
+        return m_function.seed();
+    }
+
+private:
+    mm::file_source<uint64_t> m_file;
+    mapped::partition_view<Hasher, Encoder, Minimal, RangeReducer> m_function;
+};
+
+/*
+    Read-only partitioned_phf over the mapping of a file written by save_mapped.
+    Opening the view is O(1) as for single_phf_view: a lookup reads the directory
+    entry of its partition in place, then the data of the partition.
+*/
+template <typename Hasher, typename Encoder, bool Minimal, typename RangeReducer = fastmod_reducer>
+struct partitioned_phf_view {
+    partitioned_phf_view(std::string const& filename) : m_file(filename, mm::advice::random) {
+        mapped::check_header<Hasher, Encoder, Minimal, RangeReducer>(m_file, true);
+        m_entry_words = m_file.data()[6];
+        m_seed = m_file.data()[7];
+        m_num_keys = m_file.data()[8];
+        m_table_size = m_file.data()[9];
+        m_bucketer.init(m_file.data()[10]);
+    }
+
+    partitioned_phf_view(partitioned_phf_view const&) = delete;
+    partitioned_phf_view& operator=(partitioned_phf_view const&) = delete;
+
+    template <typename T>
+    uint64_t operator()(T const& key) const {
+        auto hash = Hasher::hash(key, m_seed);
+        return position(hash);
+    }
+
+    uint64_t position(typename Hasher::hash_type hash) const {
+        uint64_t i = m_bucketer.bucket(hash.mix());
+        mapped::partition_view<Hasher, Encoder, Minimal, RangeReducer> p(
+            m_file.data(), m_file.data() + mapped::header_words + m_entry_words * i);
+        /* as in partitioned_phf, a partition with a seed of its own rehashes */
+        if (PTHASH_LIKELY(p.seed() == m_seed)) return p.offset() + p.position(hash);
+        return p.offset() + p.position(rehash(hash, p.seed()));
+    }
+
+    inline uint64_t num_keys() const {
+        return m_num_keys;
+    }
+
+    inline uint64_t table_size() const {
+        return m_table_size;
+    }
+
+    inline uint64_t seed() const {
+        return m_seed;
+    }
+
+private:
+    mm::file_source<uint64_t> m_file;
+    uint64_t m_entry_words;
+    uint64_t m_seed;
+    uint64_t m_num_keys;
+    uint64_t m_table_size;
+    uniform_bucketer<RangeReducer> m_bucketer;
+};
+
+}  // namespace pthash
\ No newline at end of file
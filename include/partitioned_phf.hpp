@@ -1,17 +1,23 @@
 #pragma once
 
-#include <thread>
-
 #include "include/single_phf.hpp"
 #include "include/builders/internal_memory_builder_partitioned_phf.hpp"
 #include "include/builders/external_memory_builder_partitioned_phf.hpp"
 
 namespace pthash {
 
-template <typename Hasher, typename Encoder, bool Minimal>
+template <typename Hasher, typename Encoder, bool Minimal,
+          typename RangeReducer = fastmod_reducer>
 struct partitioned_phf {
 private:
-    struct partition {
+    /*
+        What the lookups of a partition need, in one 64-byte-aligned header: the reducers,
+        the encoder of the pilots (its width and the pointer to its data) and the offsets.
+        A lookup touches the lines of its header and then the pilot data. The seed is shared
+        by all the partitions; num_keys is stored rather than taken from the offset of the
+        next header, so that a lookup reads no other header.
+    */
+    struct alignas(64) partition_header {
         template <typename Visitor>
         void visit(Visitor& visitor) const {
             visit_impl(visitor, *this);
@@ -22,25 +28,100 @@ private:
             visit_impl(visitor, *this);
         }
 
-        uint64_t offset;
-        single_phf<Hasher, Encoder, Minimal> f;
+        skew_bucketer<RangeReducer> bucketer;
+        RangeReducer table;
+        Encoder pilots;
+        uint64_t bucket_offset;  // index in m_bumped of the first bucket of the partition
+        uint64_t offset;         // position of the first slot of the partition
+        uint64_t num_keys;
+        uint64_t free_offset;  // index in m_free_slots of the first free slot of the partition
 
     private:
         template <typename Visitor, typename T>
         static void visit_impl(Visitor& visitor, T&& t) {
+            visitor.visit(t.bucketer);
+            visitor.visit(t.table);
+            visitor.visit(t.pilots);
+            visitor.visit(t.bucket_offset);
             visitor.visit(t.offset);
-            visitor.visit(t.f);
+            visitor.visit(t.num_keys);
+            visitor.visit(t.free_offset);
         }
     };
 
 public:
     typedef Encoder encoder_type;
+    typedef RangeReducer range_reducer_type;
     static constexpr bool minimal = Minimal;
 
+    /*
+        A partition seen as a function of its own, with local buckets and positions
+        (as written by save_mapped).
+    */
+    struct partition {
+        static constexpr bool minimal = Minimal;
+
+        partition(partitioned_phf const& f, uint64_t i)
+            : m_f(&f), m_header(&f.m_directory[i]), m_index(i), m_seed(f.partition_seed(i)) {}
+
+        inline uint64_t seed() const {
+            return m_seed;
+        }
+
+        inline uint64_t num_keys() const {
+            return m_header->num_keys;
+        }
+
+        inline uint64_t table_size() const {
+            return m_header->table.range();
+        }
+
+        inline uint64_t num_buckets() const {
+            return m_header->bucketer.num_buckets();
+        }
+
+        inline Encoder const& pilots() const {
+            return m_header->pilots;
+        }
+
+        inline uint64_t hashed_pilot(uint64_t bucket) const {
+            return m_f->hashed_pilot(m_index, bucket, m_seed);
+        }
+
+        inline uint64_t bumped_hashed_pilot() const {
+            return m_f->bumped_hashed_pilot(m_seed);
+        }
+
+        /* Return the i-th free slot, for i < table_size() - num_keys(). */
+        inline uint64_t free_slot(uint64_t i) const {
+            assert(Minimal and i < table_size() - num_keys());
+            return m_f->m_free_slots.access(m_header->free_offset + i) - m_header->offset;
+        }
+
+        /* The bumped keys of the partition, with local buckets and slots. */
+        bumped_table bumped_keys() const {
+            uint64_t begin = m_header->bucket_offset;
+            auto keys = m_f->m_bumped.keys(begin, begin + num_buckets());
+            for (auto& k : keys) {
+                k.bucket -= begin;
+                k.slot -= m_header->offset;
+            }
+            bumped_table table;
+            table.build(keys);
+            return table;
+        }
+
+    private:
+        partitioned_phf const* m_f;
+        partition_header const* m_header;
+        uint64_t m_index;
+        uint64_t m_seed;
+    };
+
     template <typename Iterator>
     build_timings build_in_internal_memory(Iterator keys, uint64_t num_keys,
                                            build_configuration const& config) {
-        internal_memory_builder_partitioned_phf<Hasher> builder;
+        internal_memory_builder_partitioned_phf<Hasher, RangeReducer> builder;
         auto timings = builder.build_from_keys(keys, num_keys, config);
         timings.encoding_seconds = build(builder, config);
         return timings;
@@ -49,7 +130,7 @@ public:
     template <typename Iterator>
     build_timings build_in_external_memory(Iterator keys, uint64_t num_keys,
                                            build_configuration const& config) {
-        external_memory_builder_partitioned_phf<Hasher> builder;
+        external_memory_builder_partitioned_phf<Hasher, RangeReducer> builder;
         auto timings = builder.build_from_keys(keys, num_keys, config);
         timings.encoding_seconds = build(builder, config);
         return timings;
@@ -57,6 +138,8 @@ public:
 
     template <typename Builder>
     double build(Builder& builder, build_configuration const& config) {
+        static_assert(std::is_same_v<typename Builder::range_reducer_type, RangeReducer>,
+                      "the builder must use the same range reducer");
         auto start = clock_type::now();
         if (Minimal && !config.minimal_output) {
             throw std::runtime_error(
@@ -71,38 +154,85 @@ public:
         m_num_keys = builder.num_keys();
         m_table_size = builder.table_size();
         m_bucketer = builder.bucketer();
-        m_partitions.resize(num_partitions);
+        m_directory.clear();
+        m_directory.resize(num_partitions);
+        m_reseeded_partitions.clear();
+        m_reseeded_seeds.clear();
 
         auto const& offsets = builder.offsets();
         auto const& builders = builder.builders();
-        uint64_t num_threads = config.num_threads;
-
-        if (num_threads > 1) {
-            std::vector<std::thread> threads(num_threads);
-            auto exe = [&](uint64_t begin, uint64_t end) {
-                for (; begin != end; ++begin) {
-                    m_partitions[begin].offset = offsets[begin];
-                    m_partitions[begin].f.build(builders[begin], config);
-                }
-            };
-
-            uint64_t num_partitions_per_thread = (num_partitions + num_threads - 1) / num_threads;
-            for (uint64_t t = 0, begin = 0; t != num_threads; ++t) {
-                uint64_t end = begin + num_partitions_per_thread;
-                if (end > num_partitions) end = num_partitions;
-                threads[t] = std::thread(exe, begin, end);
-                begin = end;
-            }
 
-            for (auto& t : threads) {
-                if (t.joinable()) t.join();
+        /*
+            The partitions are encoded in parallel, the largest first (the offsets are
+            cumulative sizes). Each task fills the header of its partition, pilots included,
+            and keeps aside its seed, free slots and bumped keys, which are then gathered
+            in order into the shared structures.
+        */
+        std::vector<uint64_t> sizes(num_partitions);
+        uint64_t end = Minimal ? m_num_keys : m_table_size;
+        for (uint64_t i = num_partitions; i-- != 0;) {
+            sizes[i] = end - offsets[i];
+            end = offsets[i];
+        }
+        std::vector<uint64_t> seeds(num_partitions), max_pilots(num_partitions);
+        std::vector<std::vector<uint64_t>> free_slots(num_partitions);
+        std::vector<std::vector<bumped_key>> bumped_keys(num_partitions);
+        run_tasks(largest_first(sizes), config.num_threads, config.pool,
+                  [&](uint64_t, uint64_t i) {
+                      auto const& b = builders[i];
+                      auto& header = m_directory[i];
+                      header.bucketer = b.bucketer();
+                      header.table.init(b.table_size());
+                      header.offset = offsets[i];
+                      header.num_keys = b.num_keys();
+                      seeds[i] = b.seed();
+                      max_pilots[i] = b.max_pilot();
+                      uint64_t num_buckets = header.bucketer.num_buckets();
+                      if constexpr (stores_hashed_pilots<Encoder>::value) {
+                          header.pilots.encode(
+                              hashed_pilots_iterator(b.pilots().data(), b.seed()), num_buckets);
+                      } else {
+                          header.pilots.encode(b.pilots().data(), num_buckets);
+                      }
+                      if (Minimal and header.num_keys < b.table_size()) {
+                          auto it = b.free_slots().begin();
+                          free_slots[i].assign(it, it + (b.table_size() - header.num_keys));
+                      }
+                      bumped_keys[i] = b.bumped_keys();
+                  });
+
+        /*
+            The free slots are stored as positions in the output, which increase across
+            the partitions, and the bumped keys by global bucket index: the buckets of
+            the first partition, then those of the second one, and so on.
+        */
+        std::vector<uint64_t> all_free_slots;
+        std::vector<bumped_key> all_bumped_keys;
+        uint64_t bucket_offset = 0;
+        for (uint64_t i = 0; i != num_partitions; ++i) {
+            auto& header = m_directory[i];
+            header.bucket_offset = bucket_offset;
+            header.free_offset = all_free_slots.size();
+            bucket_offset += header.bucketer.num_buckets();
+            if (seeds[i] != m_seed) {
+                m_reseeded_partitions.push_back(i);
+                m_reseeded_seeds.push_back(seeds[i]);
             }
-        } else {
-            for (uint64_t i = 0; i != num_partitions; ++i) {
-                m_partitions[i].offset = offsets[i];
-                m_partitions[i].f.build(builders[i], config);
+            for (uint64_t slot : free_slots[i]) all_free_slots.push_back(header.offset + slot);
+            for (auto const& k : bumped_keys[i]) {
+                all_bumped_keys.push_back(
+                    {header.bucket_offset + k.bucket, k.payload, header.offset + k.slot});
             }
+            std::vector<uint64_t>().swap(free_slots[i]);
+        }
+        m_max_pilot = max_pilots.front();
+
+        if (!all_free_slots.empty()) {
+            m_free_slots.encode(all_free_slots.begin(), all_free_slots.size());
         }
+        /* the hash of a pilot is a bijection: only the bumped buckets have this one */
+        m_bumped_hashed_pilot = default_hash64(m_max_pilot + 1, m_seed);
+        m_bumped.build(all_bumped_keys);
 
         auto stop = clock_type::now();
         return seconds(stop - start);
@@ -115,24 +245,81 @@ public:
     }
 
     uint64_t position(typename Hasher::hash_type hash) const {
-        auto b = m_bucketer.bucket(hash.mix());
-        auto const& p = m_partitions[b];
-        return p.offset + p.f.position(hash);
+        uint64_t i = m_bucketer.bucket(hash.mix());
+        uint64_t seed = partition_seed(i);
+        hash = partition_hash(hash, seed);
+        return position(hash, i, m_directory[i].bucketer.bucket(hash.first()), seed);
+    }
+
+    /*
+        Batched lookups, as in single_phf: the partition headers of a group of keys are
+        prefetched first, then their pilots, and finally the keys are resolved.
+    */
+    template <typename Iterator>
+    void lookup_batch(Iterator keys, uint64_t n, uint64_t* out) const {
+        typename Hasher::hash_type hashes[lookup_batch_size];
+        while (n != 0) {
+            uint64_t size = std::min<uint64_t>(n, lookup_batch_size);
+            keys = hash_batch<Hasher>(keys, size, m_seed, hashes);
+            position_batch(hashes, size, out);
+            out += size;
+            n -= size;
+        }
+    }
+
+    void position_batch(typename Hasher::hash_type const* hashes, uint64_t n, uint64_t* out) const {
+        uint64_t buckets[lookup_batch_size];
+        typename Hasher::hash_type partition_hashes[lookup_batch_size];
+        for (uint64_t begin = 0; begin < n; begin += lookup_batch_size) {
+            uint64_t end = std::min<uint64_t>(n, begin + lookup_batch_size);
+            for (uint64_t i = begin; i != end; ++i) {
+                out[i] = m_bucketer.bucket(hashes[i].mix());
+                char const* header = reinterpret_cast<char const*>(&m_directory[out[i]]);
+                for (uint64_t line = 0; line < sizeof(partition_header); line += 64) {
+                    PTHASH_PREFETCH(header + line);
+                }
+            }
+            for (uint64_t i = begin; i != end; ++i) {
+                auto const& p = m_directory[out[i]];
+                partition_hashes[i - begin] = partition_hash(hashes[i], partition_seed(out[i]));
+                buckets[i - begin] = p.bucketer.bucket(partition_hashes[i - begin].first());
+                p.pilots.prefetch(buckets[i - begin]);
+            }
+            for (uint64_t i = begin; i != end; ++i) {
+                out[i] = position(partition_hashes[i - begin], out[i], buckets[i - begin],
+                                  partition_seed(out[i]));
+            }
+        }
+    }
+
+    /* Whether the lookup of key goes through the free slots of its partition. */
+    template <typename T>
+    bool maps_to_free_slot(T const& key) const {
+        if constexpr (Minimal) {
+            auto hash = Hasher::hash(key, m_seed);
+            uint64_t i = m_bucketer.bucket(hash.mix());
+            auto const& p = m_directory[i];
+            uint64_t seed = partition_seed(i);
+            hash = partition_hash(hash, seed);
+            uint64_t hashed_pilot = this->hashed_pilot(i, p.bucketer.bucket(hash.first()), seed);
+            if (hashed_pilot == bumped_hashed_pilot(seed)) return false;
+            return p.table.reduce(hash.second() ^ hashed_pilot) >= p.num_keys;
+        }
+        return false;
     }
 
     uint64_t num_bits_for_pilots() const {
-        uint64_t bits = 8 * (sizeof(m_seed) + sizeof(m_num_keys) + sizeof(m_table_size) +
-                             sizeof(uint64_t)  // for std::vector::size
-                             ) +
-                        m_bucketer.num_bits();
-        for (auto const& p : m_partitions) bits += 8 * sizeof(p.offset) + p.f.num_bits_for_pilots();
-        return bits;
+        return 8 * (sizeof(constants::file_format) + sizeof(m_seed) + sizeof(m_num_keys) +
+                    sizeof(m_table_size) + sizeof(m_max_pilot) + sizeof(m_bumped_hashed_pilot) +
+                    (sizeof(partition_header) - sizeof(Encoder)) * m_directory.size() +
+                    sizeof(uint64_t) * (m_reseeded_partitions.size() + m_reseeded_seeds.size()) +
+                    4 * sizeof(uint64_t)  // for the std::vector sizes
+                    ) +
+               m_bucketer.num_bits() + num_bits_for_encoders() + m_bumped.num_bits();
     }
 
     uint64_t num_bits_for_mapper() const {
-        uint64_t bits = 0;
-        for (auto const& p : m_partitions) bits += p.f.num_bits_for_mapper();
-        return bits;
+        return m_free_slots.num_bytes() * 8;
     }
 
     uint64_t num_bits() const {
@@ -151,6 +338,19 @@ public:
         return m_seed;
     }
 
+    inline uint64_t num_partitions() const {
+        return m_directory.size();
+    }
+
+    /* Return the position of the first slot of the i-th partition. */
+    inline uint64_t partition_offset(uint64_t i) const {
+        return m_directory[i].offset;
+    }
+
+    inline partition partition_function(uint64_t i) const {
+        return partition(*this, i);
+    }
+
     template <typename Visitor>
     void visit(Visitor& visitor) const {
         visit_impl(visitor, *this);
@@ -162,20 +362,89 @@ public:
     }
 
 private:
+    /*
+        The seed of the i-th partition. A partition that could not be built with the
+        global seed has its own seed: these few are kept apart, sorted by partition.
+    */
+    inline uint64_t partition_seed(uint64_t i) const {
+        if (PTHASH_LIKELY(m_reseeded_partitions.empty())) return m_seed;
+        auto it = std::lower_bound(m_reseeded_partitions.begin(), m_reseeded_partitions.end(), i);
+        if (it == m_reseeded_partitions.end() or *it != i) return m_seed;
+        return m_reseeded_seeds[it - m_reseeded_partitions.begin()];
+    }
+
+    /* The hash of a key as seen by a partition with the given seed. */
+    inline typename Hasher::hash_type partition_hash(typename Hasher::hash_type hash,
+                                                     uint64_t seed) const {
+        if (PTHASH_LIKELY(seed == m_seed)) return hash;
+        return rehash(hash, seed);
+    }
+
+    /* Return default_hash64(pilot, seed) for the pilot of a bucket of the i-th partition. */
+    inline uint64_t hashed_pilot(uint64_t i, uint64_t bucket, uint64_t seed) const {
+        if constexpr (stores_hashed_pilots<Encoder>::value) {
+            return m_directory[i].pilots.access(bucket);
+        } else {
+            uint64_t pilot = m_directory[i].pilots.access(bucket);
+            return default_hash64(pilot, seed);
+        }
+    }
+
+    uint64_t num_bits_for_encoders() const {
+        uint64_t bits = 0;
+        for (auto const& header : m_directory) bits += header.pilots.num_bits();
+        return bits;
+    }
+
+    /* The hashed pilot that marks the bumped buckets of a partition with the given seed. */
+    inline uint64_t bumped_hashed_pilot(uint64_t seed) const {
+        if (PTHASH_LIKELY(seed == m_seed)) return m_bumped_hashed_pilot;
+        return default_hash64(m_max_pilot + 1, seed);
+    }
+
+    inline uint64_t position(typename Hasher::hash_type hash, uint64_t i, uint64_t bucket,
+                             uint64_t seed) const {
+        auto const& p = m_directory[i];
+        uint64_t hashed_pilot = this->hashed_pilot(i, bucket, seed);
+        if (PTHASH_LIKELY(hashed_pilot != bumped_hashed_pilot(seed))) {
+            uint64_t position = p.table.reduce(hash.second() ^ hashed_pilot);
+            if constexpr (Minimal) {
+                if (PTHASH_LIKELY(position < p.num_keys)) return p.offset + position;
+                return m_free_slots.access(p.free_offset + (position - p.num_keys));
+            }
+            return p.offset + position;
+        }
+        /* bumped keys are stored by global bucket index, with their output position */
+        return m_bumped.slot(p.bucket_offset + bucket, hash.second());
+    }
+
     template <typename Visitor, typename T>
     static void visit_impl(Visitor& visitor, T&& t) {
+        visit_file_format(visitor);
         visitor.visit(t.m_seed);
         visitor.visit(t.m_num_keys);
         visitor.visit(t.m_table_size);
+        visitor.visit(t.m_max_pilot);
+        visitor.visit(t.m_bumped_hashed_pilot);
         visitor.visit(t.m_bucketer);
-        visitor.visit(t.m_partitions);
+        visitor.visit(t.m_directory);
+        visitor.visit(t.m_reseeded_partitions);
+        visitor.visit(t.m_reseeded_seeds);
+        visitor.visit(t.m_free_slots);
+        visitor.visit(t.m_bumped);
     }
 
     uint64_t m_seed;
     uint64_t m_num_keys;
     uint64_t m_table_size;
-    uniform_bucketer m_bucketer;
-    std::vector<partition> m_partitions;
+    uint64_t m_max_pilot;
+    uint64_t m_bumped_hashed_pilot;
+    uniform_bucketer<RangeReducer> m_bucketer;
+    std::vector<partition_header> m_directory;
+    std::vector<uint64_t> m_reseeded_partitions;
+    std::vector<uint64_t> m_reseeded_seeds;
+    bits::elias_fano<false, false> m_free_slots;
+    bumped_table m_bumped;
 };
 
 }  // namespace pthash
\ No newline at end of file
@@ -2,4 +2,5 @@
 
 #include "utils/encoders.hpp"
 #include "include/single_phf.hpp"
-#include "include/partitioned_phf.hpp"
\ No newline at end of file
+#include "include/partitioned_phf.hpp"
+#include "include/mapped_phf.hpp"
\ No newline at end of file
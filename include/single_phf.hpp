@@ -7,15 +7,237 @@
 
 namespace pthash {
 
-template <typename Hasher, typename Encoder, bool Minimal>
+/* Number of keys whose memory accesses are overlapped by the batched lookups. */
+constexpr uint64_t lookup_batch_size = 32;
+
+/*
+    Hash size <= lookup_batch_size keys, advancing the iterator.
+    64-bit integer keys go through the vectorized kernel of the hasher, if any.
+*/
+template <typename Hasher, typename Iterator>
+Iterator hash_batch(Iterator keys, uint64_t size, uint64_t seed,
+                    typename Hasher::hash_type* hashes) {
+    assert(size <= lookup_batch_size);
+    typedef std::decay_t<decltype(*keys)> key_type;
+    if constexpr (std::is_same_v<key_type, uint64_t> and has_hash_batch<Hasher>::value) {
+        uint64_t values[lookup_batch_size];
+        for (uint64_t i = 0; i != size; ++i, ++keys) values[i] = *keys;
+        Hasher::hash_batch(values, size, seed, hashes);
+    } else {
+        for (uint64_t i = 0; i != size; ++i, ++keys) hashes[i] = Hasher::hash(*keys, seed);
+    }
+    return keys;
+}
+
+/* Iterator over the pilots that yields default_hash64(pilot, seed). */
+struct hashed_pilots_iterator {
+    hashed_pilots_iterator(uint64_t const* pilots, uint64_t seed)
+        : m_pilots(pilots), m_seed(seed) {}
+
+    inline uint64_t operator*() const {
+        return default_hash64(*m_pilots, m_seed);
+    }
+
+    inline void operator++() {
+        ++m_pilots;
+    }
+
+    inline hashed_pilots_iterator operator+(uint64_t offset) const {
+        return hashed_pilots_iterator(m_pilots + offset, m_seed);
+    }
+
+    inline bool operator!=(hashed_pilots_iterator const& other) const {
+        return m_pilots != other.m_pilots;
+    }
+
+private:
+    uint64_t const* m_pilots;
+    uint64_t m_seed;
+};
+
+inline uint64_t fingerprint_mask(uint64_t fingerprint_bits) {
+    return fingerprint_bits == 64 ? uint64_t(-1) : (uint64_t(1) << fingerprint_bits) - 1;
+}
+
+/* Return the index of the first of the n sorted values that is not less than value. */
+template <typename Values>
+uint64_t lower_bound_index(Values const& values, uint64_t n, uint64_t value) {
+    uint64_t lo = 0, hi = n;
+    while (lo < hi) {
+        uint64_t mid = (lo + hi) / 2;
+        if (values.access(mid) < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+    Return the slot of the key with the given payload in a bumped bucket: a binary search
+    for the bucket among the num_buckets bumped ones, then a scan of its (few) keys, told
+    apart by the low fingerprint_bits bits of their payloads. The sequences are those of a
+    bumped_table, or their fixed-width copies in a mapped file.
+*/
+template <typename Buckets, typename Offsets, typename Fingerprints, typename Slots>
+uint64_t bumped_slot(Buckets const& buckets, Offsets const& offsets,
+                     Fingerprints const& fingerprints, Slots const& slots, uint64_t num_buckets,
+                     uint64_t fingerprint_bits, uint64_t bucket, uint64_t payload) {
+    uint64_t b = lower_bound_index(buckets, num_buckets, bucket);
+    assert(b < num_buckets and buckets.access(b) == bucket);
+    uint64_t i = offsets.access(b);
+    if (fingerprint_bits != 0) {
+        uint64_t end = offsets.access(b + 1);
+        uint64_t fingerprint = payload & fingerprint_mask(fingerprint_bits);
+        while (i + 1 < end and fingerprints.access(i) != fingerprint) ++i;
+    }
+    return slots.access(i);
+}
+
+/*
+    The keys of the bumped buckets (see build_configuration::max_pilot) and their slots,
+    sorted by bucket and payload. The bumped buckets are stored once, with the index of
+    their first key. A key keeps only the fewest low bits of its payload that tell apart
+    the keys of every bumped bucket (none if no bucket has two keys), and the slots,
+    which increase with the keys (see place_bumped_keys), are stored with Elias-Fano.
+*/
+struct bumped_table {
+    bumped_table() : m_num_keys(0), m_num_buckets(0), m_fingerprint_bits(0) {}
+
+    void build(std::vector<bumped_key> const& keys) {
+        m_num_keys = keys.size();
+        m_num_buckets = 0;
+        m_fingerprint_bits = 0;
+        if (keys.empty()) return;
+
+        std::vector<uint64_t> buckets, offsets;
+        for (uint64_t i = 0; i != m_num_keys; ++i) {
+            if (i != 0 and keys[i].bucket == keys[i - 1].bucket) continue;
+            buckets.push_back(keys[i].bucket);
+            offsets.push_back(i);
+        }
+        offsets.push_back(m_num_keys);
+        m_num_buckets = buckets.size();
+
+        std::vector<uint64_t> fingerprints;
+        for (uint64_t b = 0; b != m_num_buckets; ++b) {
+            while (m_fingerprint_bits != 64 and
+                   !distinct_fingerprints(keys, offsets[b], offsets[b + 1], fingerprints)) {
+                ++m_fingerprint_bits;
+            }
+        }
+        m_buckets.build(buckets.begin(), m_num_buckets);
+        m_offsets.encode(offsets.begin(), offsets.size());
+        if (m_fingerprint_bits != 0) {
+            fingerprints.resize(m_num_keys);
+            for (uint64_t i = 0; i != m_num_keys; ++i) fingerprints[i] = fingerprint(keys[i]);
+            m_fingerprints.build(fingerprints.begin(), m_num_keys);
+        }
+        std::vector<uint64_t> slots(m_num_keys);
+        for (uint64_t i = 0; i != m_num_keys; ++i) {
+            assert(i == 0 or keys[i].slot > keys[i - 1].slot);
+            slots[i] = keys[i].slot;
+        }
+        m_slots.encode(slots.begin(), m_num_keys);
+    }
+
+    inline uint64_t slot(uint64_t bucket, uint64_t payload) const {
+        return bumped_slot(m_buckets, m_offsets, m_fingerprints, m_slots, m_num_buckets,
+                           m_fingerprint_bits, bucket, payload);
+    }
+
+    inline uint64_t size() const {
+        return m_num_keys;
+    }
+
+    inline uint64_t fingerprint_bits() const {
+        return m_fingerprint_bits;
+    }
+
+    /*
+        The keys of the buckets in [first_bucket, last_bucket), with their fingerprints
+        as payloads.
+    */
+    std::vector<bumped_key> keys(uint64_t first_bucket, uint64_t last_bucket) const {
+        std::vector<bumped_key> keys;
+        uint64_t b = lower_bound_index(m_buckets, m_num_buckets, first_bucket);
+        for (; b != m_num_buckets and m_buckets.access(b) < last_bucket; ++b) {
+            uint64_t bucket = m_buckets.access(b);
+            for (uint64_t i = m_offsets.access(b); i != m_offsets.access(b + 1); ++i) {
+                uint64_t fingerprint = m_fingerprint_bits != 0 ? m_fingerprints.access(i) : 0;
+                keys.push_back({bucket, fingerprint, m_slots.access(i)});
+            }
+        }
+        return keys;
+    }
+
+    std::vector<bumped_key> keys() const {
+        return keys(0, uint64_t(-1));
+    }
+
+    uint64_t num_bits() const {
+        return 8 * (sizeof(m_num_keys) + sizeof(m_num_buckets) + sizeof(m_fingerprint_bits) +
+                    m_buckets.num_bytes() + m_offsets.num_bytes() + m_fingerprints.num_bytes() +
+                    m_slots.num_bytes());
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) const {
+        visit_impl(visitor, *this);
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) {
+        visit_impl(visitor, *this);
+    }
+
+private:
+    inline uint64_t fingerprint(bumped_key const& key) const {
+        return key.payload & fingerprint_mask(m_fingerprint_bits);
+    }
+
+    /* Whether the fingerprints of keys[begin..end) are all different. */
+    bool distinct_fingerprints(std::vector<bumped_key> const& keys, uint64_t begin, uint64_t end,
+                               std::vector<uint64_t>& fingerprints) const {
+        if (end - begin < 2) return true;
+        fingerprints.clear();
+        for (uint64_t i = begin; i != end; ++i) fingerprints.push_back(fingerprint(keys[i]));
+        std::sort(fingerprints.begin(), fingerprints.end());
+        return std::adjacent_find(fingerprints.begin(), fingerprints.end()) == fingerprints.end();
+    }
+
+    template <typename Visitor, typename T>
+    static void visit_impl(Visitor& visitor, T&& t) {
+        visitor.visit(t.m_num_keys);
+        visitor.visit(t.m_num_buckets);
+        visitor.visit(t.m_fingerprint_bits);
+        visitor.visit(t.m_buckets);
+        visitor.visit(t.m_offsets);
+        visitor.visit(t.m_fingerprints);
+        visitor.visit(t.m_slots);
+    }
+
+    uint64_t m_num_keys;
+    uint64_t m_num_buckets;
+    uint64_t m_fingerprint_bits;
+    bits::compact_vector m_buckets;
+    bits::elias_fano<false, false> m_offsets;
+    bits::compact_vector m_fingerprints;
+    bits::elias_fano<false, false> m_slots;
+};
+
+template <typename Hasher, typename Encoder, bool Minimal,
+          typename RangeReducer = fastmod_reducer>
 struct single_phf {
     typedef Encoder encoder_type;
+    typedef RangeReducer range_reducer_type;
     static constexpr bool minimal = Minimal;
 
     template <typename Iterator>
     build_timings build_in_internal_memory(Iterator keys, uint64_t n,
                                            build_configuration const& config) {
-        internal_memory_builder_single_phf<Hasher> builder;
+        internal_memory_builder_single_phf<Hasher, RangeReducer> builder;
         auto timings = builder.build_from_keys(keys, n, config);
         timings.encoding_seconds = build(builder, config);
         return timings;
@@ -24,7 +246,7 @@ struct single_phf {
     template <typename Iterator>
     build_timings build_in_external_memory(Iterator keys, uint64_t n,
                                            build_configuration const& config) {
-        external_memory_builder_single_phf<Hasher> builder;
+        external_memory_builder_single_phf<Hasher, RangeReducer> builder;
         auto timings = builder.build_from_keys(keys, n, config);
         timings.encoding_seconds = build(builder, config);
         return timings;
@@ -32,6 +254,8 @@ struct single_phf {
 
     template <typename Builder>
     double build(Builder const& builder, build_configuration const& config) {
+        static_assert(std::is_same_v<typename Builder::range_reducer_type, RangeReducer>,
+                      "the builder must use the same range reducer");
         auto start = clock_type::now();
         if (Minimal && !config.minimal_output) {
             throw std::runtime_error(
@@ -42,13 +266,20 @@ struct single_phf {
         }
         m_seed = builder.seed();
         m_num_keys = builder.num_keys();
-        m_table_size = builder.table_size();
-        m_M = fastmod::computeM_u64(m_table_size);
+        m_table.init(builder.table_size());
         m_bucketer = builder.bucketer();
-        m_pilots.encode(builder.pilots().data(), m_bucketer.num_buckets());
-        if (Minimal and m_num_keys < m_table_size) {
-            m_free_slots.encode(builder.free_slots().begin(), m_table_size - m_num_keys);
+        if constexpr (stores_hashed_pilots<Encoder>::value) {
+            m_pilots.encode(hashed_pilots_iterator(builder.pilots().data(), m_seed),
+                            m_bucketer.num_buckets());
+        } else {
+            m_pilots.encode(builder.pilots().data(), m_bucketer.num_buckets());
         }
+        if (Minimal and m_num_keys < table_size()) {
+            m_free_slots.encode(builder.free_slots().begin(), table_size() - m_num_keys);
+        }
+        /* the hash of a pilot is a bijection: only the bumped buckets have this one */
+        m_bumped_hashed_pilot = default_hash64(builder.max_pilot() + 1, m_seed);
+        m_bumped.build(builder.bumped_keys());
         auto stop = clock_type::now();
         return seconds(stop - start);
     }
@@ -61,19 +292,89 @@ struct single_phf {
 
     uint64_t position(typename Hasher::hash_type hash) const {
         uint64_t bucket = m_bucketer.bucket(hash.first());
-        uint64_t pilot = m_pilots.access(bucket);
-        uint64_t hashed_pilot = default_hash64(pilot, m_seed);
-        uint64_t p = fastmod::fastmod_u64(hash.second() ^ hashed_pilot, m_M, m_table_size);
+        return position(hash, bucket);
+    }
+
+    /*
+        Batched lookups: the keys are hashed and the pilots of a whole group of keys
+        are prefetched before any of the keys is resolved, so that the cache misses
+        of different keys overlap. The pilots of the group are then read together
+        (gathered with AVX2 for compact, see access_batch) and hashed together, with
+        MurmurHash2_64_batch, before the positions are written to out[0..n).
+    */
+    template <typename Iterator>
+    void lookup_batch(Iterator keys, uint64_t n, uint64_t* out) const {
+        typename Hasher::hash_type hashes[lookup_batch_size];
+        while (n != 0) {
+            uint64_t size = std::min<uint64_t>(n, lookup_batch_size);
+            keys = hash_batch<Hasher>(keys, size, m_seed, hashes);
+            position_batch(hashes, size, out);
+            out += size;
+            n -= size;
+        }
+    }
+
+    void position_batch(typename Hasher::hash_type const* hashes, uint64_t n, uint64_t* out) const {
+        uint64_t hashed_pilots[lookup_batch_size];
+        for (uint64_t begin = 0; begin < n; begin += lookup_batch_size) {
+            uint64_t end = std::min<uint64_t>(n, begin + lookup_batch_size);
+            for (uint64_t i = begin; i != end; ++i) out[i] = prefetch_pilot(hashes[i]);
+            access_batch(m_pilots, out + begin, end - begin, hashed_pilots);
+            if constexpr (!stores_hashed_pilots<Encoder>::value) {
+                MurmurHash2_64_batch(hashed_pilots, end - begin, m_seed, hashed_pilots);
+            }
+            for (uint64_t i = begin; i != end; ++i) {
+                out[i] = position(hashes[i], out[i], hashed_pilots[i - begin]);
+            }
+        }
+    }
+
+    /* Return the bucket of hash, after having issued a prefetch for its pilot. */
+    inline uint64_t prefetch_pilot(typename Hasher::hash_type hash) const {
+        uint64_t bucket = m_bucketer.bucket(hash.first());
+        m_pilots.prefetch(bucket);
+        return bucket;
+    }
+
+    inline uint64_t position(typename Hasher::hash_type hash, uint64_t bucket) const {
+        return position(hash, bucket, hashed_pilot(bucket));
+    }
+
+    inline uint64_t position(typename Hasher::hash_type hash, uint64_t bucket,
+                             uint64_t hashed_pilot) const {
+        if (PTHASH_LIKELY(hashed_pilot != m_bumped_hashed_pilot)) {
+            uint64_t p = m_table.reduce(hash.second() ^ hashed_pilot);
+            if constexpr (Minimal) {
+                if (PTHASH_LIKELY(p < num_keys())) return p;
+                return m_free_slots.access(p - num_keys());
+            }
+            return p;
+        }
+        return m_bumped.slot(bucket, hash.second());
+    }
+
+    /* Whether the lookup of key goes through the free slots. */
+    template <typename T>
+    bool maps_to_free_slot(T const& key) const {
+        return hash_maps_to_free_slot(Hasher::hash(key, m_seed));
+    }
+
+    /* Whether the lookup of the key with the given hash goes through the free slots. */
+    bool hash_maps_to_free_slot(typename Hasher::hash_type hash) const {
         if constexpr (Minimal) {
-            if (PTHASH_LIKELY(p < num_keys())) return p;
-            return m_free_slots.access(p - num_keys());
+            uint64_t bucket = m_bucketer.bucket(hash.first());
+            uint64_t hashed_pilot = this->hashed_pilot(bucket);
+            if (hashed_pilot == m_bumped_hashed_pilot) return false;
+            return m_table.reduce(hash.second() ^ hashed_pilot) >= num_keys();
         }
-        return p;
+        return false;
     }
 
     uint64_t num_bits_for_pilots() const {
-        return 8 * (sizeof(m_seed) + sizeof(m_num_keys) + sizeof(m_table_size) + sizeof(m_M)) +
-               m_bucketer.num_bits() + m_pilots.num_bits();
+        return 8 * (sizeof(constants::file_format) + sizeof(m_seed) + sizeof(m_num_keys) +
+                    sizeof(m_bumped_hashed_pilot)) +
+               m_table.num_bits() + m_bucketer.num_bits() + m_pilots.num_bits() +
+               m_bumped.num_bits();
     }
 
     uint64_t num_bits_for_mapper() const {
@@ -89,13 +390,46 @@ struct single_phf {
     }
 
     inline uint64_t table_size() const {
-        return m_table_size;
+        return m_table.range();
     }
 
     inline uint64_t seed() const {
         return m_seed;
     }
 
+    inline uint64_t num_buckets() const {
+        return m_bucketer.num_buckets();
+    }
+
+    inline Encoder const& pilots() const {
+        return m_pilots;
+    }
+
+    /* Return default_hash64(pilot, seed) for the pilot of the given bucket. */
+    inline uint64_t hashed_pilot(uint64_t bucket) const {
+        if constexpr (stores_hashed_pilots<Encoder>::value) {
+            return m_pilots.access(bucket);
+        } else {
+            uint64_t pilot = m_pilots.access(bucket);
+            return default_hash64(pilot, m_seed);
+        }
+    }
+
+    /* The hashed pilot that marks the bumped buckets. */
+    inline uint64_t bumped_hashed_pilot() const {
+        return m_bumped_hashed_pilot;
+    }
+
+    inline bumped_table const& bumped_keys() const {
+        return m_bumped;
+    }
+
+    /* Return the i-th free slot, for i < table_size() - num_keys(). */
+    inline uint64_t free_slot(uint64_t i) const {
+        assert(Minimal and i < table_size() - num_keys());
+        return m_free_slots.access(i);
+    }
+
     template <typename Visitor>
     void visit(Visitor& visitor) const {
         visit_impl(visitor, *this);
@@ -109,21 +443,24 @@ struct single_phf {
 private:
     template <typename Visitor, typename T>
     static void visit_impl(Visitor& visitor, T&& t) {
+        visit_file_format(visitor);
         visitor.visit(t.m_seed);
         visitor.visit(t.m_num_keys);
-        visitor.visit(t.m_table_size);
-        visitor.visit(t.m_M);
+        visitor.visit(t.m_table);
         visitor.visit(t.m_bucketer);
         visitor.visit(t.m_pilots);
         visitor.visit(t.m_free_slots);
+        visitor.visit(t.m_bumped_hashed_pilot);
+        visitor.visit(t.m_bumped);
     }
     uint64_t m_seed;
     uint64_t m_num_keys;
-    uint64_t m_table_size;
-    __uint128_t m_M;
-    skew_bucketer m_bucketer;
+    RangeReducer m_table;  // maps hashes to [0, table_size)
+    skew_bucketer<RangeReducer> m_bucketer;
     Encoder m_pilots;
     bits::elias_fano<false, false> m_free_slots;
+    uint64_t m_bumped_hashed_pilot;
+    bumped_table m_bumped;
 };
 
 }  // namespace pthash
\ No newline at end of file
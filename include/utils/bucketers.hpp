@@ -4,41 +4,143 @@
 
 namespace pthash {
 
+/*
+    Range reducers map a 64-bit hash to [0, range).
+    They are used by the bucketers and to compute the final position of a key.
+*/
+
+/*
+    Exact hash % range, computed with a 128-bit constant (Lemire's fastmod).
+    The constant is kept as two 64-bit words: the reducer is then 8-byte aligned and
+    packs without padding (see the partition directory of partitioned_phf).
+*/
+struct fastmod_reducer {
+    fastmod_reducer() : m_range(0), m_M_low(0), m_M_high(0) {}
+
+    void init(uint64_t range) {
+        m_range = range;
+        __uint128_t M = fastmod::computeM_u64(m_range);
+        m_M_low = static_cast<uint64_t>(M);
+        m_M_high = static_cast<uint64_t>(M >> 64);
+    }
+
+    inline uint64_t reduce(uint64_t hash) const {
+        __uint128_t M = (static_cast<__uint128_t>(m_M_high) << 64) | m_M_low;
+        return fastmod::fastmod_u64(hash, M, m_range);
+    }
+
+    inline uint64_t range() const {
+        return m_range;
+    }
+
+    size_t num_bits() const {
+        return 8 * (sizeof(m_range) + sizeof(m_M_low) + sizeof(m_M_high));
+    }
+
+    static std::string name() {
+        return "fastmod";
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) const {
+        visit_impl(visitor, *this);
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) {
+        visit_impl(visitor, *this);
+    }
+
+private:
+    template <typename Visitor, typename T>
+    static void visit_impl(Visitor& visitor, T&& t) {
+        visitor.visit(t.m_range);
+        visitor.visit(t.m_M_low);  // same bytes as the 128-bit constant on little-endian
+        visitor.visit(t.m_M_high);
+    }
+    uint64_t m_range;
+    uint64_t m_M_low, m_M_high;
+};
+
+/*
+    Multiply-shift reduction (Lemire's fastrange): (hash * range) >> 64.
+    Fastrange only looks at the high bits of its input, whereas the keys of a bucket share
+    the high bits of their hash and the pilot is xor-ed into the hash:
+    the input is first multiplied by an odd constant, so that its high bits depend on
+    all of its bits.
+*/
+struct fastrange_reducer {
+    fastrange_reducer() : m_range(0) {}
+
+    void init(uint64_t range) {
+        m_range = range;
+    }
+
+    inline uint64_t reduce(uint64_t hash) const {
+        return (static_cast<__uint128_t>(hash * 0x9e3779b97f4a7c15) * m_range) >> 64;
+    }
+
+    inline uint64_t range() const {
+        return m_range;
+    }
+
+    size_t num_bits() const {
+        return 8 * sizeof(m_range);
+    }
+
+    static std::string name() {
+        return "fastrange";
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) const {
+        visit_impl(visitor, *this);
+    }
+
+    template <typename Visitor>
+    void visit(Visitor& visitor) {
+        visit_impl(visitor, *this);
+    }
+
+private:
+    template <typename Visitor, typename T>
+    static void visit_impl(Visitor& visitor, T&& t) {
+        visitor.visit(t.m_range);
+    }
+    uint64_t m_range;
+};
+
+template <typename RangeReducer>
 struct skew_bucketer {
-    skew_bucketer()
-        : m_num_dense_buckets(0)
-        , m_num_sparse_buckets(0)
-        , m_M_num_dense_buckets(0)
-        , m_M_num_sparse_buckets(0) {}
+    typedef RangeReducer range_reducer_type;
+
+    skew_bucketer() : m_num_dense_buckets(0) {}
 
     void init(uint64_t num_buckets) {
         m_num_dense_buckets = constants::b * num_buckets;
-        m_num_sparse_buckets = num_buckets - m_num_dense_buckets;
-        m_M_num_dense_buckets = fastmod::computeM_u64(m_num_dense_buckets);
-        m_M_num_sparse_buckets = fastmod::computeM_u64(m_num_sparse_buckets);
+        m_dense_buckets.init(m_num_dense_buckets);
+        m_sparse_buckets.init(num_buckets - m_num_dense_buckets);
     }
 
     inline uint64_t bucket(uint64_t hash) const {
         static const uint64_t T = constants::a * UINT64_MAX;
-        return (hash < T) ? fastmod::fastmod_u64(hash, m_M_num_dense_buckets, m_num_dense_buckets)
-                          : m_num_dense_buckets + fastmod::fastmod_u64(hash, m_M_num_sparse_buckets,
-                                                                       m_num_sparse_buckets);
+        return (hash < T) ? m_dense_buckets.reduce(hash)
+                          : m_num_dense_buckets + m_sparse_buckets.reduce(hash);
     }
 
     uint64_t num_buckets() const {
-        return m_num_dense_buckets + m_num_sparse_buckets;
+        return m_dense_buckets.range() + m_sparse_buckets.range();
     }
 
     size_t num_bits() const {
-        return 8 * (sizeof(m_num_dense_buckets) + sizeof(m_num_sparse_buckets) +
-                    sizeof(m_M_num_dense_buckets) + sizeof(m_M_num_sparse_buckets));
+        return 8 * sizeof(m_num_dense_buckets) + m_dense_buckets.num_bits() +
+               m_sparse_buckets.num_bits();
     }
 
     void swap(skew_bucketer& other) {
         std::swap(m_num_dense_buckets, other.m_num_dense_buckets);
-        std::swap(m_num_sparse_buckets, other.m_num_sparse_buckets);
-        std::swap(m_M_num_dense_buckets, other.m_M_num_dense_buckets);
-        std::swap(m_M_num_sparse_buckets, other.m_M_num_sparse_buckets);
+        std::swap(m_dense_buckets, other.m_dense_buckets);
+        std::swap(m_sparse_buckets, other.m_sparse_buckets);
     }
 
     template <typename Visitor>
@@ -55,33 +157,34 @@ private:
     template <typename Visitor, typename T>
     static void visit_impl(Visitor& visitor, T&& t) {
         visitor.visit(t.m_num_dense_buckets);
-        visitor.visit(t.m_num_sparse_buckets);
-        visitor.visit(t.m_M_num_dense_buckets);
-        visitor.visit(t.m_M_num_sparse_buckets);
+        visitor.visit(t.m_dense_buckets);
+        visitor.visit(t.m_sparse_buckets);
     }
 
-    uint64_t m_num_dense_buckets, m_num_sparse_buckets;
-    __uint128_t m_M_num_dense_buckets, m_M_num_sparse_buckets;
+    uint64_t m_num_dense_buckets;
+    RangeReducer m_dense_buckets, m_sparse_buckets;
 };
 
+template <typename RangeReducer>
 struct uniform_bucketer {
-    uniform_bucketer() : m_num_buckets(0), m_M_num_buckets(0) {}
+    typedef RangeReducer range_reducer_type;
+
+    uniform_bucketer() {}
 
     void init(uint64_t num_buckets) {
-        m_num_buckets = num_buckets;
-        m_M_num_buckets = fastmod::computeM_u64(m_num_buckets);
+        m_buckets.init(num_buckets);
     }
 
     inline uint64_t bucket(uint64_t hash) const {
-        return fastmod::fastmod_u64(hash, m_M_num_buckets, m_num_buckets);
+        return m_buckets.reduce(hash);
     }
 
     uint64_t num_buckets() const {
-        return m_num_buckets;
+        return m_buckets.range();
     }
 
     size_t num_bits() const {
-        return 8 * (sizeof(m_num_buckets) + sizeof(m_M_num_buckets));
+        return m_buckets.num_bits();
     }
 
     template <typename Visitor>
@@ -97,11 +200,9 @@ struct uniform_bucketer {
 private:
     template <typename Visitor, typename T>
     static void visit_impl(Visitor& visitor, T&& t) {
-        visitor.visit(t.m_num_buckets);
-        visitor.visit(t.m_M_num_buckets);
+        visitor.visit(t.m_buckets);
     }
-    uint64_t m_num_buckets;
-    __uint128_t m_M_num_buckets;
+    RangeReducer m_buckets;
 };
 
-}  // namespace pthash
\ No newline at end of file
+}  // namespace pthash
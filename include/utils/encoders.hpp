@@ -2,13 +2,24 @@
 
 #include "external/bits/include/compact_vector.hpp"
 #include "external/bits/include/elias_fano.hpp"
+#include "include/utils/util.hpp"
 
 #include <vector>
 #include <unordered_map>
+#include <type_traits>
 #include <cassert>
 
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 namespace pthash {
 
+/* Prefetch the memory word holding the i-th value of a compact_vector. */
+static inline void prefetch_value(bits::compact_vector const& values, uint64_t i) {
+    PTHASH_PREFETCH(values.data().data() + ((i * values.width()) >> 6));
+}
+
 struct compact {
     template <typename Iterator>
     void encode(Iterator begin, uint64_t n) {
@@ -31,6 +42,14 @@ struct compact {
         return m_values.access(i);
     }
 
+    void prefetch(uint64_t i) const {
+        prefetch_value(m_values, i);
+    }
+
+    bits::compact_vector const& values() const {
+        return m_values;
+    }
+
     template <typename Visitor>
     void visit(Visitor& visitor) const {
         visitor.visit(m_values);
@@ -45,6 +64,51 @@ private:
     bits::compact_vector m_values;
 };
 
+/* Write pilots.access(indices[i]) to out[i], for i = 0..n-1. */
+template <typename Encoder>
+static inline void access_batch(Encoder const& pilots, uint64_t const* indices, uint64_t n,
+                                uint64_t* out) {
+    for (uint64_t i = 0; i != n; ++i) out[i] = pilots.access(indices[i]);
+}
+
+/*
+    Same as above, with the words of 4 values gathered at a time with AVX2. The second
+    word of a value is only loaded if the value crosses a word boundary, so that the
+    gather never reads past the end of the data.
+*/
+static inline void access_batch(compact const& pilots, uint64_t const* indices, uint64_t n,
+                                uint64_t* out) {
+    auto const& values = pilots.values();
+    uint64_t i = 0;
+#ifdef __AVX2__
+    uint64_t width = values.width();
+    long long const* data = reinterpret_cast<long long const*>(values.data().data());
+    const __m256i w = _mm256_set1_epi64x(width);
+    const __m256i mask = _mm256_set1_epi64x(width == 64 ? -1 : (1ULL << width) - 1);
+    const __m256i shift_mask = _mm256_set1_epi64x(63);
+    const __m256i word_bits = _mm256_set1_epi64x(64);
+    for (; i + 4 <= n; i += 4) {
+        __m256i index = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(indices + i));
+        /* index * width, with width < 2^32 and the high half of index multiplied apart */
+        __m256i position = _mm256_add_epi64(
+            _mm256_mul_epu32(index, w),
+            _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(index, 32), w), 32));
+        __m256i block = _mm256_srli_epi64(position, 6);
+        __m256i shift = _mm256_and_si256(position, shift_mask);
+        __m256i low = _mm256_i64gather_epi64(data, block, 8);
+        __m256i crosses = _mm256_cmpgt_epi64(_mm256_add_epi64(shift, w), word_bits);
+        __m256i high = _mm256_mask_i64gather_epi64(_mm256_setzero_si256(), data + 1, block,
+                                                   crosses, 8);
+        /* a shift by 64 (when shift is 0) gives 0 */
+        __m256i value =
+            _mm256_or_si256(_mm256_srlv_epi64(low, shift),
+                            _mm256_sllv_epi64(high, _mm256_sub_epi64(word_bits, shift)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_and_si256(value, mask));
+    }
+#endif
+    for (; i != n; ++i) out[i] = values.access(indices[i]);
+}
+
 struct partitioned_compact {
     static const uint64_t partition_size = 256;
     static_assert(partition_size > 0);
@@ -77,6 +141,7 @@ struct partitioned_compact {
             begin_partition = end_partition;
         }
         bvb.build(m_values);
+        m_size = n;
     }
 
     static std::string name() {
@@ -94,13 +159,33 @@ struct partitioned_compact {
     }
 
     uint64_t access(uint64_t i) const {
-        uint64_t partition = i / partition_size;
-        uint64_t offset = i % partition_size;
-        uint64_t num_bits = m_bits_per_value[partition + 1] - m_bits_per_value[partition];
-        uint64_t position = m_bits_per_value[partition] * partition_size + offset * num_bits;
+        uint64_t num_bits;
+        uint64_t position = bit_position(i, num_bits);
         return m_values.get_bits(position, num_bits);
     }
 
+    /*
+        Prefetch the word of the i-th value. The widths of the partitions take 4 bytes
+        per 256 values: reading them here is likely a cache hit, the value itself is not.
+    */
+    void prefetch(uint64_t i) const {
+        uint64_t num_bits;
+        uint64_t position = bit_position(i, num_bits);
+        PTHASH_PREFETCH(m_values.data().data() + (position >> 6));
+    }
+
+    /*
+        The cumulative widths: the values of the i-th partition take w = bits_per_value()[i + 1]
+        - bits_per_value()[i] bits each, starting from bit bits_per_value()[i] * partition_size.
+    */
+    std::vector<uint32_t> const& bits_per_value() const {
+        return m_bits_per_value;
+    }
+
+    bits::bit_vector const& values() const {
+        return m_values;
+    }
+
     template <typename Visitor>
     void visit(Visitor& visitor) const {
         visit_impl(visitor, *this);
@@ -112,6 +197,14 @@ struct partitioned_compact {
     }
 
 private:
+    /* Position of the first bit of the i-th value, whose width is stored in num_bits. */
+    inline uint64_t bit_position(uint64_t i, uint64_t& num_bits) const {
+        uint64_t partition = i / partition_size;
+        uint64_t offset = i % partition_size;
+        num_bits = m_bits_per_value[partition + 1] - m_bits_per_value[partition];
+        return m_bits_per_value[partition] * partition_size + offset * num_bits;
+    }
+
     template <typename Visitor, typename T>
     static void visit_impl(Visitor& visitor, T&& t) {
         visitor.visit(t.m_size);
@@ -182,6 +275,19 @@ struct dictionary {
         return m_dict.access(rank);
     }
 
+    /* The dictionary is small and likely cache-resident: only prefetch the rank. */
+    void prefetch(uint64_t i) const {
+        prefetch_value(m_ranks, i);
+    }
+
+    bits::compact_vector const& ranks() const {
+        return m_ranks;
+    }
+
+    bits::compact_vector const& dict() const {
+        return m_dict;
+    }
+
     template <typename Visitor>
     void visit(Visitor& visitor) const {
         visit_impl(visitor, *this);
@@ -202,6 +308,27 @@ private:
     bits::compact_vector m_dict;
 };
 
+/*
+    Same as dictionary, but single_phf feeds it default_hash64(pilot, seed) in place of
+    each pilot: lookups read the hashed pilot directly instead of hashing the pilot.
+    The number of distinct values (hence, the ranks) does not change.
+*/
+struct hashed_dictionary : dictionary {
+    static constexpr bool hashed_pilots = true;
+
+    static std::string name() {
+        return "hashed_dictionary";
+    }
+};
+
+/* Whether the encoder stores hashed pilots (see hashed_dictionary). */
+template <typename Encoder, typename = void>
+struct stores_hashed_pilots : std::false_type {};
+
+template <typename Encoder>
+struct stores_hashed_pilots<Encoder, std::enable_if_t<Encoder::hashed_pilots>> : std::true_type {
+};
+
 struct elias_fano {
     template <typename Iterator>
     void encode(Iterator begin, uint64_t n) {
@@ -225,6 +352,9 @@ struct elias_fano {
         return m_values.diff(i);
     }
 
+    /* Locating the i-th value requires a select query: nothing cheap to prefetch. */
+    void prefetch(uint64_t) const {}
+
     template <typename Visitor>
     void visit(Visitor& visitor) const {
         visitor.visit(m_values);
@@ -330,6 +460,9 @@ struct sdc {
         return m_dict.access(rank);
     }
 
+    /* Codewords are located through an Elias-Fano index: nothing cheap to prefetch. */
+    void prefetch(uint64_t) const {}
+
     template <typename Visitor>
     void visit(Visitor& visitor) {
         visitor.visit(m_ranks);
@@ -349,6 +482,10 @@ private:
 
 template <typename Front, typename Back>
 struct dual {
+    static constexpr bool hashed_pilots = stores_hashed_pilots<Front>::value;
+    static_assert(stores_hashed_pilots<Back>::value == hashed_pilots,
+                  "cannot mix encoders of pilots and of hashed pilots");
+
     template <typename Iterator>
     void encode(Iterator begin, uint64_t n) {
         uint64_t front_size = n * 0.3;
@@ -369,6 +506,22 @@ struct dual {
         return m_back.access(i - m_front.size());
     }
 
+    void prefetch(uint64_t i) const {
+        if (i < m_front.size()) {
+            m_front.prefetch(i);
+        } else {
+            m_back.prefetch(i - m_front.size());
+        }
+    }
+
+    Front const& front() const {
+        return m_front;
+    }
+
+    Back const& back() const {
+        return m_back;
+    }
+
     template <typename Visitor>
     void visit(Visitor& visitor) const {
         visit_impl(visitor, *this);
@@ -394,5 +547,6 @@ private:
 typedef dual<compact, compact> compact_compact;
 typedef dual<dictionary, dictionary> dictionary_dictionary;
 typedef dual<dictionary, elias_fano> dictionary_elias_fano;
+typedef dual<hashed_dictionary, hashed_dictionary> hashed_dictionary_dictionary;
 
 }  // namespace pthash
\ No newline at end of file
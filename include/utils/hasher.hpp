@@ -2,6 +2,18 @@
 
 // See also https://github.com/jermp/bench_hash_functions
 
+#include <cstring>  // for memcpy
+
+#include "include/utils/util.hpp"
+
+#if defined(__AVX512F__) && defined(__AVX512DQ__)
+#include <immintrin.h>
+#define PTHASH_AVX512_HASH
+#elif defined(__AVX2__)
+#include <immintrin.h>
+#define PTHASH_AVX2_HASH
+#endif
+
 namespace pthash {
 
 namespace util {
@@ -114,6 +126,61 @@ static uint64_t MurmurHash2_64(void const* key, size_t len, uint64_t seed) {
     return h;
 }
 
+#ifdef PTHASH_AVX2_HASH
+/* 64x64 -> 64 bit multiplication, not available before AVX-512DQ */
+static inline __m256i mm256_mullo_epi64(__m256i a, __m256i b) {
+    __m256i lo = _mm256_mul_epu32(a, b);
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)),
+                                     _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b));
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+#endif
+
+/*
+    Same as MurmurHash2_64(&vals[i], sizeof(uint64_t), seed) for i = 0..n-1,
+    but computed on 8 (AVX-512) or 4 (AVX2) values at a time when possible.
+*/
+static void MurmurHash2_64_batch(uint64_t const* vals, uint64_t n, uint64_t seed, uint64_t* out) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t i = 0;
+
+#if defined(PTHASH_AVX512_HASH)
+    const __m512i mm = _mm512_set1_epi64(m);
+    const __m512i h0 = _mm512_set1_epi64(seed ^ (sizeof(uint64_t) * m));
+    for (; i + 8 <= n; i += 8) {
+        __m512i k = _mm512_loadu_si512(vals + i);
+        k = _mm512_mullo_epi64(k, mm);
+        k = _mm512_xor_si512(k, _mm512_srli_epi64(k, r));
+        k = _mm512_mullo_epi64(k, mm);
+        __m512i h = _mm512_mullo_epi64(_mm512_xor_si512(h0, k), mm);
+        h = _mm512_xor_si512(h, _mm512_srli_epi64(h, r));
+        h = _mm512_mullo_epi64(h, mm);
+        h = _mm512_xor_si512(h, _mm512_srli_epi64(h, r));
+        _mm512_storeu_si512(out + i, h);
+    }
+#elif defined(PTHASH_AVX2_HASH)
+    const __m256i mm = _mm256_set1_epi64x(m);
+    const __m256i h0 = _mm256_set1_epi64x(seed ^ (sizeof(uint64_t) * m));
+    for (; i + 4 <= n; i += 4) {
+        __m256i k = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(vals + i));
+        k = mm256_mullo_epi64(k, mm);
+        k = _mm256_xor_si256(k, _mm256_srli_epi64(k, r));
+        k = mm256_mullo_epi64(k, mm);
+        __m256i h = mm256_mullo_epi64(_mm256_xor_si256(h0, k), mm);
+        h = _mm256_xor_si256(h, _mm256_srli_epi64(h, r));
+        h = mm256_mullo_epi64(h, mm);
+        h = _mm256_xor_si256(h, _mm256_srli_epi64(h, r));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), h);
+    }
+#else
+    (void)m;
+    (void)r;
+#endif
+
+    for (; i != n; ++i) out[i] = MurmurHash2_64(vals + i, sizeof(uint64_t), seed);
+}
+
 inline uint64_t default_hash64(uint64_t val, uint64_t seed) {
     return MurmurHash2_64(&val, sizeof(uint64_t), seed);
 }
@@ -163,6 +230,23 @@ private:
     uint64_t m_first, m_second;
 };
 
+/*
+    The hash of a key under another seed, computed from its hash under the global seed:
+    a partition that fails to build is rebuilt with its own seed without the keys.
+    Keys with equal hashes keep equal hashes: only a new global seed separates them,
+    so the builder does not reseed a partition with equal hashes. For hash64, this is
+    the case of any two keys whose 64-bit hashes collide.
+*/
+inline hash64 rehash(hash64 hash, uint64_t seed) {
+    return default_hash64(hash.first(), seed);
+}
+
+inline hash128 rehash(hash128 hash, uint64_t seed) {
+    /* the new first hash depends on both halves, so that the buckets change */
+    uint64_t second = default_hash64(hash.second(), ~seed);
+    return {default_hash64(hash.first() ^ second, seed), second};
+}
+
 struct murmurhash2_64 {
     typedef hash64 hash_type;
 
@@ -180,6 +264,21 @@ struct murmurhash2_64 {
     static inline hash64 hash(uint64_t val, uint64_t seed) {
         return MurmurHash2_64(reinterpret_cast<char const*>(&val), sizeof(val), seed);
     }
+
+    // hash n uint64_t values at once
+    static inline void hash_batch(uint64_t const* vals, uint64_t n, uint64_t seed, hash64* out) {
+        constexpr uint64_t block_size = 32;
+        uint64_t hashes[block_size];
+        for (uint64_t begin = 0; begin < n; begin += block_size) {
+            uint64_t size = std::min<uint64_t>(n - begin, block_size);
+            MurmurHash2_64_batch(vals + begin, size, seed, hashes);
+            for (uint64_t i = 0; i != size; ++i) out[begin + i] = hashes[i];
+        }
+    }
+
+    static std::string name() {
+        return "murmurhash2_64";
+    }
 };
 
 struct murmurhash2_128 {
@@ -202,6 +301,570 @@ struct murmurhash2_128 {
         return {MurmurHash2_64(reinterpret_cast<char const*>(&val), sizeof(val), seed),
                 MurmurHash2_64(reinterpret_cast<char const*>(&val), sizeof(val), ~seed)};
     }
+
+    // hash n uint64_t values at once
+    static inline void hash_batch(uint64_t const* vals, uint64_t n, uint64_t seed, hash128* out) {
+        constexpr uint64_t block_size = 32;
+        uint64_t first[block_size], second[block_size];
+        for (uint64_t begin = 0; begin < n; begin += block_size) {
+            uint64_t size = std::min<uint64_t>(n - begin, block_size);
+            MurmurHash2_64_batch(vals + begin, size, seed, first);
+            MurmurHash2_64_batch(vals + begin, size, ~seed, second);
+            for (uint64_t i = 0; i != size; ++i) out[begin + i] = {first[i], second[i]};
+        }
+    }
+
+    static std::string name() {
+        return "murmurhash2_128";
+    }
+};
+
+/*
+    This code is an adaptation of wyhash (final version 4)
+    https://github.com/wangyi-fudan/wyhash
+        by Wang Yi
+*/
+namespace wy {
+
+static const uint64_t secret[4] = {0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL,
+                                   0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL};
+
+static inline void mum(uint64_t* a, uint64_t* b) {
+    __uint128_t r = static_cast<__uint128_t>(*a) * *b;
+    *a = static_cast<uint64_t>(r);
+    *b = static_cast<uint64_t>(r >> 64);
+}
+
+static inline uint64_t mix(uint64_t a, uint64_t b) {
+    mum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t r8(uint8_t const* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t r4(uint8_t const* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t r3(uint8_t const* p, size_t k) {
+    return (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[k >> 1]) << 8) |
+           p[k - 1];
+}
+
+/* Read the first/last bytes of an input of at most 16 bytes. */
+static inline void read_short(uint8_t const* p, size_t len, uint64_t* a, uint64_t* b) {
+    if (PTHASH_LIKELY(len >= 4)) {
+        *a = (r4(p) << 32) | r4(p + ((len >> 3) << 2));
+        *b = (r4(p + len - 4) << 32) | r4(p + len - 4 - ((len >> 3) << 2));
+    } else if (PTHASH_LIKELY(len > 0)) {
+        *a = r3(p, len);
+        *b = 0;
+    } else {
+        *a = *b = 0;
+    }
+}
+
+}  // namespace wy
+
+static uint64_t wyhash(void const* key, size_t len, uint64_t seed) {
+    uint8_t const* p = static_cast<uint8_t const*>(key);
+    seed ^= wy::mix(seed ^ wy::secret[0], wy::secret[1]);
+    uint64_t a, b;
+    if (PTHASH_LIKELY(len <= 16)) {
+        wy::read_short(p, len, &a, &b);
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wy::mix(wy::r8(p) ^ wy::secret[1], wy::r8(p + 8) ^ seed);
+                see1 = wy::mix(wy::r8(p + 16) ^ wy::secret[2], wy::r8(p + 24) ^ see1);
+                see2 = wy::mix(wy::r8(p + 32) ^ wy::secret[3], wy::r8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (PTHASH_LIKELY(i > 48));
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wy::mix(wy::r8(p) ^ wy::secret[1], wy::r8(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+        a = wy::r8(p + i - 16);
+        b = wy::r8(p + i - 8);
+    }
+    a ^= wy::secret[1];
+    b ^= seed;
+    wy::mum(&a, &b);
+    return wy::mix(a ^ wy::secret[0] ^ len, b ^ wy::secret[1]);
+}
+
+/*
+    128-bit variant of wyhash computed in a single pass over the input.
+    Two independent 64-bit states are carried along (the second one uses
+    the other two secrets), so that inputs sharing a suffix do not collide
+    as soon as a 64-bit state does, and each state is finalized on its own.
+*/
+static void wyhash128(void const* key, size_t len, uint64_t seed, uint64_t* first,
+                      uint64_t* second) {
+    uint8_t const* p = static_cast<uint8_t const*>(key);
+    uint64_t seed1 = seed ^ wy::mix(seed ^ wy::secret[0], wy::secret[1]);
+    uint64_t seed2 = seed ^ wy::mix(seed ^ wy::secret[2], wy::secret[3]);
+    uint64_t a, b;
+    if (PTHASH_LIKELY(len <= 16)) {
+        wy::read_short(p, len, &a, &b);
+    } else {
+        size_t i = len;
+        while (i > 16) {
+            uint64_t x = wy::r8(p), y = wy::r8(p + 8);
+            seed1 = wy::mix(x ^ wy::secret[1], y ^ seed1);
+            seed2 = wy::mix(x ^ wy::secret[3], y ^ seed2);
+            i -= 16;
+            p += 16;
+        }
+        a = wy::r8(p + i - 16);
+        b = wy::r8(p + i - 8);
+    }
+    uint64_t a1 = a ^ wy::secret[1], b1 = b ^ seed1;
+    uint64_t a2 = a ^ wy::secret[3], b2 = b ^ seed2;
+    wy::mum(&a1, &b1);
+    wy::mum(&a2, &b2);
+    *first = wy::mix(a1 ^ wy::secret[0] ^ len, b1 ^ wy::secret[1]);
+    *second = wy::mix(a2 ^ wy::secret[2] ^ len, b2 ^ wy::secret[3]);
+}
+
+struct wyhash_64 {
+    typedef hash64 hash_type;
+
+    // generic range of bytes
+    static inline hash64 hash(byte_range range, uint64_t seed) {
+        return wyhash(range.begin, range.end - range.begin, seed);
+    }
+
+    // specialization for std::string
+    static inline hash64 hash(std::string const& val, uint64_t seed) {
+        return wyhash(val.data(), val.size(), seed);
+    }
+
+    // specialization for uint64_t
+    static inline hash64 hash(uint64_t val, uint64_t seed) {
+        return wyhash(&val, sizeof(val), seed);
+    }
+
+    static std::string name() {
+        return "wyhash_64";
+    }
+};
+
+struct wyhash_128 {
+    typedef hash128 hash_type;
+
+    // generic range of bytes
+    static inline hash128 hash(byte_range range, uint64_t seed) {
+        uint64_t first, second;
+        wyhash128(range.begin, range.end - range.begin, seed, &first, &second);
+        return {first, second};
+    }
+
+    // specialization for std::string
+    static inline hash128 hash(std::string const& val, uint64_t seed) {
+        uint64_t first, second;
+        wyhash128(val.data(), val.size(), seed, &first, &second);
+        return {first, second};
+    }
+
+    // specialization for uint64_t
+    static inline hash128 hash(uint64_t val, uint64_t seed) {
+        uint64_t first, second;
+        wyhash128(&val, sizeof(val), seed, &first, &second);
+        return {first, second};
+    }
+
+    static std::string name() {
+        return "wyhash_128";
+    }
+};
+
+/*
+    This code is an adaptation of XXH3 (xxHash 0.8), seeded variants only
+    https://github.com/Cyan4973/xxHash
+        by Yann Collet
+*/
+namespace xxh3 {
+
+static const uint64_t prime32_1 = 0x9E3779B1U;
+static const uint64_t prime32_2 = 0x85EBCA77U;
+static const uint64_t prime32_3 = 0xC2B2AE3DU;
+static const uint64_t prime64_1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t prime64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t prime64_3 = 0x165667B19E3779F9ULL;
+static const uint64_t prime64_4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t prime64_5 = 0x27D4EB2F165667C5ULL;
+static const uint64_t prime_mx1 = 0x165667919E3779F9ULL;
+static const uint64_t prime_mx2 = 0x9FB21C651E98DF25ULL;
+
+static const size_t secret_size = 192;
+static const size_t secret_size_min = 136;
+static const size_t stripe_len = 64;
+static const size_t acc_nb = stripe_len / sizeof(uint64_t);
+static const size_t midsize_max = 240;
+
+alignas(64) static const uint8_t secret[secret_size] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
 };
 
+static inline uint64_t r8(uint8_t const* p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint32_t r4(uint8_t const* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint32_t rotl32(uint32_t x, int r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline void mul128(uint64_t lhs, uint64_t rhs, uint64_t* lo, uint64_t* hi) {
+    __uint128_t r = static_cast<__uint128_t>(lhs) * rhs;
+    *lo = static_cast<uint64_t>(r);
+    *hi = static_cast<uint64_t>(r >> 64);
+}
+
+static inline uint64_t mul128_fold64(uint64_t lhs, uint64_t rhs) {
+    uint64_t lo, hi;
+    mul128(lhs, rhs, &lo, &hi);
+    return lo ^ hi;
+}
+
+static inline uint64_t xxh64_avalanche(uint64_t h) {
+    h ^= h >> 33;
+    h *= prime64_2;
+    h ^= h >> 29;
+    h *= prime64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint64_t avalanche(uint64_t h) {
+    h ^= h >> 37;
+    h *= prime_mx1;
+    h ^= h >> 32;
+    return h;
+}
+
+static inline uint64_t rrmxmx(uint64_t h, uint64_t len) {
+    h ^= rotl64(h, 49) ^ rotl64(h, 24);
+    h *= prime_mx2;
+    h ^= (h >> 35) + len;
+    h *= prime_mx2;
+    return h ^ (h >> 28);
+}
+
+static inline uint64_t mix16B(uint8_t const* p, uint8_t const* s, uint64_t seed) {
+    return mul128_fold64(r8(p) ^ (r8(s) + seed), r8(p + 8) ^ (r8(s + 8) - seed));
+}
+
+static inline void mix32B(uint64_t* lo, uint64_t* hi, uint8_t const* p1, uint8_t const* p2,
+                          uint8_t const* s, uint64_t seed) {
+    *lo += mix16B(p1, s, seed);
+    *lo ^= r8(p2) + r8(p2 + 8);
+    *hi += mix16B(p2, s + 16, seed);
+    *hi ^= r8(p1) + r8(p1 + 8);
+}
+
+/* Long inputs (> 240 bytes): 8 accumulators fed one 64-byte stripe at a time. */
+static inline void accumulate_512(uint64_t* acc, uint8_t const* p, uint8_t const* s) {
+    for (size_t i = 0; i != acc_nb; ++i) {
+        uint64_t data_val = r8(p + 8 * i);
+        uint64_t data_key = data_val ^ r8(s + 8 * i);
+        acc[i ^ 1] += data_val;
+        acc[i] += (data_key & 0xFFFFFFFF) * (data_key >> 32);
+    }
+}
+
+static inline void scramble(uint64_t* acc, uint8_t const* s) {
+    for (size_t i = 0; i != acc_nb; ++i) {
+        uint64_t a = acc[i];
+        a ^= a >> 47;
+        a ^= r8(s + 8 * i);
+        a *= prime32_1;
+        acc[i] = a;
+    }
+}
+
+static inline uint64_t merge_accs(uint64_t const* acc, uint8_t const* s, uint64_t start) {
+    uint64_t result = start;
+    for (size_t i = 0; i != 4; ++i) {
+        result += mul128_fold64(acc[2 * i] ^ r8(s + 16 * i), acc[2 * i + 1] ^ r8(s + 16 * i + 8));
+    }
+    return avalanche(result);
+}
+
+static void hash_long(uint8_t const* p, size_t len, uint64_t seed, uint64_t* first,
+                      uint64_t* second) {
+    uint8_t custom_secret[secret_size];
+    uint8_t const* s = secret;
+    if (seed != 0) {
+        for (size_t i = 0; i != secret_size / 16; ++i) {
+            uint64_t lo = r8(secret + 16 * i) + seed;
+            uint64_t hi = r8(secret + 16 * i + 8) - seed;
+            memcpy(custom_secret + 16 * i, &lo, 8);
+            memcpy(custom_secret + 16 * i + 8, &hi, 8);
+        }
+        s = custom_secret;
+    }
+
+    uint64_t acc[acc_nb] = {prime32_3, prime64_1, prime64_2, prime64_3,
+                            prime64_4, prime32_2, prime64_5, prime32_1};
+    const size_t stripes_per_block = (secret_size - stripe_len) / 8;
+    const size_t block_len = stripe_len * stripes_per_block;
+    const size_t num_blocks = (len - 1) / block_len;
+    for (size_t n = 0; n != num_blocks; ++n) {
+        for (size_t i = 0; i != stripes_per_block; ++i) {
+            accumulate_512(acc, p + n * block_len + i * stripe_len, s + i * 8);
+        }
+        scramble(acc, s + secret_size - stripe_len);
+    }
+    const size_t num_stripes = ((len - 1) - block_len * num_blocks) / stripe_len;
+    for (size_t i = 0; i != num_stripes; ++i) {
+        accumulate_512(acc, p + num_blocks * block_len + i * stripe_len, s + i * 8);
+    }
+    accumulate_512(acc, p + len - stripe_len, s + secret_size - stripe_len - 7);
+
+    *first = merge_accs(acc, s + 11, len * prime64_1);
+    if (second) *second = merge_accs(acc, s + secret_size - 64 - 11, ~(len * prime64_2));
+}
+
+}  // namespace xxh3
+
+static uint64_t XXH3_64(void const* key, size_t len, uint64_t seed) {
+    using namespace xxh3;
+    uint8_t const* p = static_cast<uint8_t const*>(key);
+    uint8_t const* s = xxh3::secret;
+
+    if (PTHASH_LIKELY(len <= 16)) {
+        if (len > 8) {
+            uint64_t lo = r8(p) ^ ((r8(s + 24) ^ r8(s + 32)) + seed);
+            uint64_t hi = r8(p + len - 8) ^ ((r8(s + 40) ^ r8(s + 48)) - seed);
+            return avalanche(len + __builtin_bswap64(lo) + hi + mul128_fold64(lo, hi));
+        }
+        if (len >= 4) {
+            seed ^= static_cast<uint64_t>(__builtin_bswap32(static_cast<uint32_t>(seed))) << 32;
+            uint64_t input64 = r4(p + len - 4) + (static_cast<uint64_t>(r4(p)) << 32);
+            return rrmxmx(input64 ^ ((r8(s + 8) ^ r8(s + 16)) - seed), len);
+        }
+        if (len > 0) {
+            uint32_t combined = (static_cast<uint32_t>(p[0]) << 16) |
+                                (static_cast<uint32_t>(p[len >> 1]) << 24) | p[len - 1] |
+                                (static_cast<uint32_t>(len) << 8);
+            uint64_t bitflip = (r4(s) ^ r4(s + 4)) + seed;
+            return xxh64_avalanche(combined ^ bitflip);
+        }
+        return xxh64_avalanche(seed ^ (r8(s + 56) ^ r8(s + 64)));
+    }
+
+    if (len <= 128) {
+        uint64_t acc = len * prime64_1;
+        if (len > 32) {
+            if (len > 64) {
+                if (len > 96) {
+                    acc += mix16B(p + 48, s + 96, seed);
+                    acc += mix16B(p + len - 64, s + 112, seed);
+                }
+                acc += mix16B(p + 32, s + 64, seed);
+                acc += mix16B(p + len - 48, s + 80, seed);
+            }
+            acc += mix16B(p + 16, s + 32, seed);
+            acc += mix16B(p + len - 32, s + 48, seed);
+        }
+        acc += mix16B(p, s, seed);
+        acc += mix16B(p + len - 16, s + 16, seed);
+        return avalanche(acc);
+    }
+
+    if (len <= midsize_max) {
+        uint64_t acc = len * prime64_1;
+        for (size_t i = 0; i != 8; ++i) acc += mix16B(p + 16 * i, s + 16 * i, seed);
+        uint64_t acc_end = mix16B(p + len - 16, s + secret_size_min - 17, seed);
+        acc = avalanche(acc);
+        for (size_t i = 8; i < len / 16; ++i) {
+            acc_end += mix16B(p + 16 * i, s + 16 * (i - 8) + 3, seed);
+        }
+        return avalanche(acc + acc_end);
+    }
+
+    uint64_t h;
+    hash_long(p, len, seed, &h, nullptr);
+    return h;
+}
+
+static void XXH3_128(void const* key, size_t len, uint64_t seed, uint64_t* first,
+                     uint64_t* second) {
+    using namespace xxh3;
+    uint8_t const* p = static_cast<uint8_t const*>(key);
+    uint8_t const* s = xxh3::secret;
+
+    if (PTHASH_LIKELY(len <= 16)) {
+        if (len > 8) {
+            uint64_t bitflipl = (r8(s + 32) ^ r8(s + 40)) - seed;
+            uint64_t bitfliph = (r8(s + 48) ^ r8(s + 56)) + seed;
+            uint64_t input_lo = r8(p);
+            uint64_t input_hi = r8(p + len - 8);
+            uint64_t m_lo, m_hi;
+            mul128(input_lo ^ input_hi ^ bitflipl, prime64_1, &m_lo, &m_hi);
+            m_lo += static_cast<uint64_t>(len - 1) << 54;
+            input_hi ^= bitfliph;
+            m_hi += input_hi + (input_hi & 0xFFFFFFFF) * (prime32_2 - 1);
+            m_lo ^= __builtin_bswap64(m_hi);
+            uint64_t h_lo, h_hi;
+            mul128(m_lo, prime64_2, &h_lo, &h_hi);
+            h_hi += m_hi * prime64_2;
+            *first = avalanche(h_lo);
+            *second = avalanche(h_hi);
+        } else if (len >= 4) {
+            seed ^= static_cast<uint64_t>(__builtin_bswap32(static_cast<uint32_t>(seed))) << 32;
+            uint64_t input64 = r4(p) + (static_cast<uint64_t>(r4(p + len - 4)) << 32);
+            uint64_t keyed = input64 ^ ((r8(s + 16) ^ r8(s + 24)) + seed);
+            uint64_t m_lo, m_hi;
+            mul128(keyed, prime64_1 + (len << 2), &m_lo, &m_hi);
+            m_hi += m_lo << 1;
+            m_lo ^= m_hi >> 3;
+            m_lo ^= m_lo >> 35;
+            m_lo *= prime_mx2;
+            m_lo ^= m_lo >> 28;
+            *first = m_lo;
+            *second = avalanche(m_hi);
+        } else if (len > 0) {
+            uint32_t combinedl = (static_cast<uint32_t>(p[0]) << 16) |
+                                 (static_cast<uint32_t>(p[len >> 1]) << 24) | p[len - 1] |
+                                 (static_cast<uint32_t>(len) << 8);
+            uint32_t combinedh = rotl32(__builtin_bswap32(combinedl), 13);
+            *first = xxh64_avalanche(combinedl ^ ((r4(s) ^ r4(s + 4)) + seed));
+            *second = xxh64_avalanche(combinedh ^ ((r4(s + 8) ^ r4(s + 12)) - seed));
+        } else {
+            *first = xxh64_avalanche(seed ^ r8(s + 64) ^ r8(s + 72));
+            *second = xxh64_avalanche(seed ^ r8(s + 80) ^ r8(s + 88));
+        }
+        return;
+    }
+
+    if (len > midsize_max) {
+        hash_long(p, len, seed, first, second);
+        return;
+    }
+
+    uint64_t lo = len * prime64_1, hi = 0;
+    if (len <= 128) {
+        if (len > 32) {
+            if (len > 64) {
+                if (len > 96) mix32B(&lo, &hi, p + 48, p + len - 64, s + 96, seed);
+                mix32B(&lo, &hi, p + 32, p + len - 48, s + 64, seed);
+            }
+            mix32B(&lo, &hi, p + 16, p + len - 32, s + 32, seed);
+        }
+        mix32B(&lo, &hi, p, p + len - 16, s, seed);
+    } else {
+        for (size_t i = 32; i < 160; i += 32) {
+            mix32B(&lo, &hi, p + i - 32, p + i - 16, s + i - 32, seed);
+        }
+        lo = avalanche(lo);
+        hi = avalanche(hi);
+        for (size_t i = 160; i <= len; i += 32) {
+            mix32B(&lo, &hi, p + i - 32, p + i - 16, s + 3 + i - 160, seed);
+        }
+        mix32B(&lo, &hi, p + len - 16, p + len - 32, s + secret_size_min - 17 - 16, 0 - seed);
+    }
+    *first = avalanche(lo + hi);
+    *second = 0 - avalanche(lo * prime64_1 + hi * prime64_4 + (len - seed) * prime64_2);
+}
+
+
+struct xxhash3_64 {
+    typedef hash64 hash_type;
+
+    // generic range of bytes
+    static inline hash64 hash(byte_range range, uint64_t seed) {
+        return XXH3_64(range.begin, range.end - range.begin, seed);
+    }
+
+    // specialization for std::string
+    static inline hash64 hash(std::string const& val, uint64_t seed) {
+        return XXH3_64(val.data(), val.size(), seed);
+    }
+
+    // specialization for uint64_t
+    static inline hash64 hash(uint64_t val, uint64_t seed) {
+        return XXH3_64(&val, sizeof(val), seed);
+    }
+
+    static std::string name() {
+        return "xxhash3_64";
+    }
+};
+
+struct xxhash3_128 {
+    typedef hash128 hash_type;
+
+    // generic range of bytes
+    static inline hash128 hash(byte_range range, uint64_t seed) {
+        uint64_t first, second;
+        XXH3_128(range.begin, range.end - range.begin, seed, &first, &second);
+        return {first, second};
+    }
+
+    // specialization for std::string
+    static inline hash128 hash(std::string const& val, uint64_t seed) {
+        uint64_t first, second;
+        XXH3_128(val.data(), val.size(), seed, &first, &second);
+        return {first, second};
+    }
+
+    // specialization for uint64_t
+    static inline hash128 hash(uint64_t val, uint64_t seed) {
+        uint64_t first, second;
+        XXH3_128(&val, sizeof(val), seed, &first, &second);
+        return {first, second};
+    }
+
+    static std::string name() {
+        return "xxhash3_128";
+    }
+};
+
+/* Whether Hasher provides hash_batch() for uint64_t keys. */
+template <typename Hasher, typename = void>
+struct has_hash_batch : std::false_type {};
+
+template <typename Hasher>
+struct has_hash_batch<Hasher, std::void_t<decltype(Hasher::hash_batch(
+                                  std::declval<uint64_t const*>(), uint64_t(0), uint64_t(0),
+                                  std::declval<typename Hasher::hash_type*>()))>>
+    : std::true_type {};
+
 }  // namespace pthash
\ No newline at end of file
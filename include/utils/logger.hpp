@@ -28,6 +28,19 @@ struct progress_logger {
         }
     }
 
+    /* Log num_events events at once, e.g., a block of keys. */
+    inline void log(uint64_t num_events) {
+        m_logged_events += num_events;
+        if (m_logged_events >= m_next_event_to_log) {
+            update(false);
+            while (m_next_event_to_log <= m_logged_events and
+                   m_next_event_to_log != m_total_events) {
+                m_next_event_to_log += m_log_step;
+            }
+            if (m_next_event_to_log > m_total_events) m_next_event_to_log = m_total_events;
+        }
+    }
+
     void finalize() {
         if (m_next_event_to_log != static_cast<uint64_t>(-1)) {
             assert(m_next_event_to_log == m_total_events);
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cassert>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>  // for exception_ptr
+#include <vector>
+
+namespace pthash {
+
+/*
+    Threads kept alive across the parallel phases of the constructions, so that building
+    many functions does not create and join new threads at every phase
+    (see build_configuration::pool).
+
+    run(n, job) calls job(i) on the i-th thread of the pool for every i < n: the calls run
+    concurrently, as on n new threads, so they may wait for each other. It returns when
+    all of them are done and rethrows their exceptions. One run executes at a time.
+*/
+struct thread_pool {
+    thread_pool(uint64_t num_threads)
+        : m_job(nullptr)
+        , m_invoke(nullptr)
+        , m_errors(nullptr)
+        , m_num_tasks(0)
+        , m_num_running(0)
+        , m_generation(0)
+        , m_stop(false) {
+        m_threads.reserve(num_threads);
+        for (uint64_t i = 0; i != num_threads; ++i) {
+            m_threads.emplace_back(&thread_pool::work, this, i);
+        }
+    }
+
+    ~thread_pool() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_start.notify_all();
+        for (auto& t : m_threads) t.join();
+    }
+
+    thread_pool(thread_pool const&) = delete;
+    thread_pool& operator=(thread_pool const&) = delete;
+
+    uint64_t num_threads() const {
+        return m_threads.size();
+    }
+
+    /* Whether the calling thread is one of the threads of the pool. */
+    bool is_pool_thread() const {
+        return current_pool() == this;
+    }
+
+    template <typename Job>
+    void run(uint64_t num_tasks, Job const& job) {
+        assert(num_tasks <= num_threads());
+        assert(!is_pool_thread());  // the run would wait for its own thread
+        std::lock_guard<std::mutex> run_lock(m_run_mutex);
+        std::vector<std::exception_ptr> errors(num_tasks);
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_job = &job;
+            m_invoke = [](void const* job, uint64_t i) { (*static_cast<Job const*>(job))(i); };
+            m_errors = errors.data();
+            m_num_tasks = num_tasks;
+            m_num_running = num_tasks;
+            ++m_generation;
+        }
+        m_start.notify_all();
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_done.wait(lock, [&]() { return m_num_running == 0; });
+        }
+        for (auto const& error : errors) {
+            if (error) std::rethrow_exception(error);
+        }
+    }
+
+    /*
+        A buffer of the calling thread that outlives the task: on the threads of a pool,
+        the next tasks reuse its memory instead of allocating their own.
+    */
+    static std::vector<uint64_t>& scratch() {
+        static thread_local std::vector<uint64_t> buffer;
+        return buffer;
+    }
+
+private:
+    void work(uint64_t i) {
+        current_pool() = this;
+        uint64_t generation = 0;
+        while (true) {
+            void const* job;
+            void (*invoke)(void const*, uint64_t);
+            std::exception_ptr* errors;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_start.wait(lock, [&]() { return m_stop or m_generation != generation; });
+                if (m_stop) return;
+                generation = m_generation;
+                if (i >= m_num_tasks) continue;
+                job = m_job;
+                invoke = m_invoke;
+                errors = m_errors;
+            }
+            try {
+                invoke(job, i);
+            } catch (...) { errors[i] = std::current_exception(); }
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (--m_num_running == 0) m_done.notify_one();
+            }
+        }
+    }
+
+    static thread_pool const*& current_pool() {
+        static thread_local thread_pool const* pool = nullptr;
+        return pool;
+    }
+
+    std::vector<std::thread> m_threads;
+    std::mutex m_run_mutex;
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+
+    /* the current run, guarded by m_mutex */
+    void const* m_job;
+    void (*m_invoke)(void const*, uint64_t);
+    std::exception_ptr* m_errors;
+    uint64_t m_num_tasks;
+    uint64_t m_num_running;
+    uint64_t m_generation;
+    bool m_stop;
+};
+
+}  // namespace pthash
\ No newline at end of file
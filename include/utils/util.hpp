@@ -1,12 +1,22 @@
 #pragma once
 
 #include <chrono>
+#include <stdexcept>
 #include <string>
 
 #include "essentials.hpp"
 #include "external/fastmod/fastmod.h"
 
 #define PTHASH_LIKELY(expr) __builtin_expect((bool)(expr), true)
+#define PTHASH_PREFETCH(addr) __builtin_prefetch(addr)
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PTHASH_PAUSE() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define PTHASH_PAUSE() asm volatile("yield")
+#else
+#define PTHASH_PAUSE()
+#endif
 
 namespace pthash {
 
@@ -16,10 +26,21 @@ namespace constants {
 static const uint64_t available_ram = sysconf(_SC_PAGESIZE) * sysconf(_SC_PHYS_PAGES);
 static const uint64_t invalid_seed = uint64_t(-1);
 static const uint64_t invalid_num_buckets = uint64_t(-1);
+/* No bucket is bumped: the pilot marking the bumped buckets, max_pilot + 1, is never reached. */
+static const uint64_t unlimited_pilot = uint64_t(-1) - 1;
 static const uint64_t min_partition_size = 10000;
+/* Seeds tried for a partition that fails with the global seed, before giving up. */
+static const uint64_t max_partition_reseeds = 10;
 
 static const std::string default_tmp_dirname(".");
 
+/*
+    First word of the functions saved with essentials::save, "PTHASHV1". The files of the
+    versions without it start with the seed instead: their layout differs (e.g., in the
+    bucketers and in the bumped keys) and loading them fails.
+*/
+static const uint64_t file_format = 0x3156485341485450;
+
 /* p1=n*a keys are placed in p2=m*b buckets */
 constexpr float a = 0.6;
 constexpr float b = 0.3;
@@ -33,6 +54,16 @@ static inline uint64_t random_value() {
     return rng();
 }
 
+/* Visit the format word of a saved function: when loading, refuse the other formats. */
+template <typename Visitor>
+void visit_file_format(Visitor& visitor) {
+    uint64_t format = constants::file_format;
+    visitor.visit(format);
+    if (format != constants::file_format) {
+        throw std::runtime_error("unsupported file format: not saved by this version of PTHash");
+    }
+}
+
 template <typename DurationType>
 double seconds(DurationType const& d) {
     return static_cast<double>(std::chrono::duration_cast<std::chrono::milliseconds>(d).count()) /
@@ -0,0 +1,73 @@
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "include/utils/util.hpp"
+#include "include/utils/logger.hpp"
+#include "include/builders/search.hpp"
+
+/*
+    Compares, for each class of bucket size, the check for in-bucket collisions
+    used by the search against sorting the positions of the bucket.
+    The positions are random slots of a table as large as the one of 10M keys,
+    so that duplicates are as rare as during the search.
+*/
+
+using namespace pthash;
+
+template <typename Check>
+double nanosec_per_check(std::vector<uint64_t> const& positions, uint64_t bucket_size,
+                         Check check, uint64_t& num_duplicates) {
+    std::vector<uint64_t> bucket(bucket_size);
+    uint64_t num_checks = positions.size() / bucket_size;
+    num_duplicates = 0;
+    auto start = clock_type::now();
+    for (uint64_t i = 0; i != num_checks; ++i) {
+        /* copy, as the search does, because the check may reorder the values */
+        std::copy(positions.begin() + i * bucket_size, positions.begin() + (i + 1) * bucket_size,
+                  bucket.begin());
+        num_duplicates += check(bucket.data(), bucket_size);
+    }
+    return seconds(clock_type::now() - start) * 1e9 / num_checks;
+}
+
+int main() {
+    static const uint64_t table_size = 10000000;
+    static const uint64_t num_positions = 20000000;
+    static const uint64_t seed = 1234567890;
+
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<uint64_t> distr(0, table_size - 1);
+    std::vector<uint64_t> positions(num_positions);
+    for (auto& p : positions) p = distr(rng);
+
+    auto sort_check = [](uint64_t* values, uint64_t n) {
+        std::sort(values, values + n);
+        return std::adjacent_find(values, values + n) != values + n;
+    };
+    auto search_check = [](uint64_t* values, uint64_t n) { return has_duplicates(values, n); };
+
+    std::vector<uint64_t> bucket_sizes;
+    for (uint64_t s = 1; s <= 16; ++s) bucket_sizes.push_back(s);
+    for (uint64_t s : {20, 24, 32, 48, 64}) bucket_sizes.push_back(s);
+    bucket_sizes.push_back(MAX_BUCKET_SIZE);
+
+    std::cout << "bucket_size\tsort [ns/check]\thas_duplicates [ns/check]\tspeedup" << std::endl;
+    for (uint64_t bucket_size : bucket_sizes) {
+        uint64_t sort_duplicates = 0;
+        uint64_t search_duplicates = 0;
+        double sort_ns = nanosec_per_check(positions, bucket_size, sort_check, sort_duplicates);
+        double search_ns =
+            nanosec_per_check(positions, bucket_size, search_check, search_duplicates);
+        if (sort_duplicates != search_duplicates) {
+            std::cerr << "error: different number of buckets with duplicates for bucket_size "
+                      << bucket_size << std::endl;
+            return 1;
+        }
+        std::cout << bucket_size << '\t' << sort_ns << '\t' << search_ns << '\t'
+                  << sort_ns / search_ns << std::endl;
+    }
+
+    return 0;
+}
@@ -14,8 +14,11 @@ struct build_parameters {
 
     Iterator keys;
     uint64_t num_keys;
-    bool external_memory, check, lookup;
+    bool external_memory, check, lookup, latency;
+    uint64_t lookup_threads;
     std::string encoder_type;
+    std::string range_reduction;
+    std::string hasher;
     std::string output_filename;
 };
 
@@ -32,7 +35,8 @@ void build_benchmark(Builder& builder, build_timings const& timings,
         std::cout << "partitioning: " << timings.partitioning_seconds << " [sec]" << std::endl;
         std::cout << "mapping+ordering: " << timings.mapping_ordering_seconds << " [sec]"
                   << std::endl;
-        std::cout << "searching: " << timings.searching_seconds << " [sec]" << std::endl;
+        std::cout << "searching: " << timings.searching_seconds << " [sec] ("
+                  << timings.searching_trials_per_second() << " trials/sec)" << std::endl;
         std::cout << "encoding: " << encoding_seconds << " [sec]" << std::endl;
         std::cout << "total: " << total_seconds << " [sec]" << std::endl;
     }
@@ -58,6 +62,15 @@ void build_benchmark(Builder& builder, build_timings const& timings,
     }
 
     double nanosec_per_key = 0;
+    double batched_nanosec_per_key = 0;
+    parallel_perf_result parallel = {0.0, 0.0};
+    parallel_perf_result parallel_shuffled = {0.0, 0.0};
+    auto accumulate = [](parallel_perf_result& total, parallel_perf_result const& partial,
+                         double weight) {
+        total.queries_per_sec += partial.queries_per_sec * weight;
+        total.nanosec_per_key += partial.nanosec_per_key * weight;
+    };
+    latency_percentiles fast_path_latency, free_slot_path_latency;
     if (params.lookup) {
         if (config.verbose_output) essentials::logger("measuring lookup time...");
         if (params.external_memory) {
@@ -69,14 +82,68 @@ void build_benchmark(Builder& builder, build_timings const& timings,
                 queries.reserve(cur_batch_size);
                 for (uint64_t i = 0; i != cur_batch_size; ++i, ++query) queries.push_back(*query);
                 nanosec_per_key += perf(queries.begin(), cur_batch_size, f) * cur_batch_size;
+                batched_nanosec_per_key +=
+                    perf_batch(queries.begin(), cur_batch_size, f) * cur_batch_size;
+                if (params.latency and remaining == params.num_keys) {  // first batch only
+                    std::tie(fast_path_latency, free_slot_path_latency) =
+                        perf_latency(queries.begin(), cur_batch_size, f);
+                }
+                if (params.lookup_threads > 0) {
+                    accumulate(parallel,
+                               perf_parallel(queries.begin(), cur_batch_size, f,
+                                             params.lookup_threads, false),
+                               cur_batch_size);
+                    accumulate(parallel_shuffled,
+                               perf_parallel(queries.begin(), cur_batch_size, f,
+                                             params.lookup_threads, true),
+                               cur_batch_size);
+                }
                 remaining -= cur_batch_size;
                 queries.clear();
             }
             nanosec_per_key /= params.num_keys;
+            batched_nanosec_per_key /= params.num_keys;
+            parallel.queries_per_sec /= params.num_keys;
+            parallel.nanosec_per_key /= params.num_keys;
+            parallel_shuffled.queries_per_sec /= params.num_keys;
+            parallel_shuffled.nanosec_per_key /= params.num_keys;
         } else {
             nanosec_per_key = perf(params.keys, params.num_keys, f);
+            batched_nanosec_per_key = perf_batch(params.keys, params.num_keys, f);
+            if (params.latency) {
+                std::tie(fast_path_latency, free_slot_path_latency) =
+                    perf_latency(params.keys, params.num_keys, f);
+            }
+            if (params.lookup_threads > 0) {
+                parallel =
+                    perf_parallel(params.keys, params.num_keys, f, params.lookup_threads, false);
+                parallel_shuffled =
+                    perf_parallel(params.keys, params.num_keys, f, params.lookup_threads, true);
+            }
+        }
+        if (config.verbose_output) {
+            std::cout << nanosec_per_key << " [nanosec/key]" << std::endl;
+            std::cout << batched_nanosec_per_key << " [nanosec/key] (batched lookups)"
+                      << std::endl;
+            if (params.latency) {
+                auto print = [](char const* path, latency_percentiles const& l) {
+                    std::cout << "latency of " << l.num_samples << " sampled lookups (" << path
+                              << "): p50 = " << l.p50 << ", p90 = " << l.p90
+                              << ", p99 = " << l.p99 << ", p99.9 = " << l.p999
+                              << " [nanosec]" << std::endl;
+                };
+                print("fast path", fast_path_latency);
+                print("free slot path", free_slot_path_latency);
+            }
+            if (params.lookup_threads > 0) {
+                std::cout << "with " << params.lookup_threads << " threads:" << std::endl;
+                std::cout << "  " << parallel.queries_per_sec << " [queries/sec], "
+                          << parallel.nanosec_per_key << " [nanosec/key] per thread" << std::endl;
+                std::cout << "  " << parallel_shuffled.queries_per_sec << " [queries/sec], "
+                          << parallel_shuffled.nanosec_per_key
+                          << " [nanosec/key] per thread (shuffled queries)" << std::endl;
+            }
         }
-        if (config.verbose_output) std::cout << nanosec_per_key << " [nanosec/key]" << std::endl;
     }
 
     essentials::json_lines result;
@@ -85,21 +152,46 @@ void build_benchmark(Builder& builder, build_timings const& timings,
     result.add("c", config.c);
     result.add("alpha", config.alpha);
     result.add("minimal", config.minimal_output ? "true" : "false");
+    result.add("hasher", Builder::hasher_type::name().c_str());
     result.add("encoder_type", Function::encoder_type::name().c_str());
+    result.add("range_reduction", Function::range_reducer_type::name().c_str());
     result.add("num_partitions", config.num_partitions);
     if (config.seed != constants::invalid_seed) result.add("seed", config.seed);
     result.add("num_threads", config.num_threads);
     result.add("external_memory", params.external_memory ? "true" : "false");
+    result.add("counting_sort", config.counting_sort ? "true" : "false");
+    if (config.max_pilot != constants::unlimited_pilot) result.add("max_pilot", config.max_pilot);
 
     result.add("partitioning_seconds", timings.partitioning_seconds);
     result.add("mapping_ordering_seconds", timings.mapping_ordering_seconds);
     result.add("searching_seconds", timings.searching_seconds);
+    result.add("searching_trials", timings.searching_trials);
+    result.add("searching_trials_per_second", timings.searching_trials_per_second());
     result.add("encoding_seconds", encoding_seconds);
     result.add("total_seconds", total_seconds);
     result.add("pt_bits_per_key", pt_bits_per_key);
     result.add("mapper_bits_per_key", mapper_bits_per_key);
     result.add("bits_per_key", bits_per_key);
     result.add("nanosec_per_key", nanosec_per_key);
+    result.add("batched_nanosec_per_key", batched_nanosec_per_key);
+    if (params.lookup and params.latency) {
+        auto add = [&](std::string const& path, latency_percentiles const& l) {
+            result.add("latency_" + path + "_samples", l.num_samples);
+            result.add("latency_" + path + "_p50_ns", l.p50);
+            result.add("latency_" + path + "_p90_ns", l.p90);
+            result.add("latency_" + path + "_p99_ns", l.p99);
+            result.add("latency_" + path + "_p999_ns", l.p999);
+        };
+        add("fast", fast_path_latency);
+        add("free_slot", free_slot_path_latency);
+    }
+    if (params.lookup_threads > 0) {
+        result.add("lookup_threads", params.lookup_threads);
+        result.add("mt_queries_per_sec", parallel.queries_per_sec);
+        result.add("mt_nanosec_per_key", parallel.nanosec_per_key);
+        result.add("mt_shuffled_queries_per_sec", parallel_shuffled.queries_per_sec);
+        result.add("mt_shuffled_nanosec_per_key", parallel_shuffled.nanosec_per_key);
+    }
     result.print_line();
 
     if (params.output_filename != "") {
@@ -112,20 +204,22 @@ void build_benchmark(Builder& builder, build_timings const& timings,
 template <bool partitioned, typename Encoder, typename Builder, typename Iterator>
 void choose_phf(Builder& builder, build_timings const& timings,
                 build_parameters<Iterator> const& params, build_configuration const& config) {
+    typedef typename Builder::hasher_type hasher_type;
+    typedef typename Builder::range_reducer_type range_reducer_type;
     if constexpr (partitioned) {
         if (config.minimal_output) {
-            build_benchmark<partitioned_phf<typename Builder::hasher_type, Encoder, true>>(
+            build_benchmark<partitioned_phf<hasher_type, Encoder, true, range_reducer_type>>(
                 builder, timings, params, config);
         } else {
-            build_benchmark<partitioned_phf<typename Builder::hasher_type, Encoder, false>>(
+            build_benchmark<partitioned_phf<hasher_type, Encoder, false, range_reducer_type>>(
                 builder, timings, params, config);
         }
     } else {
         if (config.minimal_output) {
-            build_benchmark<single_phf<typename Builder::hasher_type, Encoder, true>>(
+            build_benchmark<single_phf<hasher_type, Encoder, true, range_reducer_type>>(
                 builder, timings, params, config);
         } else {
-            build_benchmark<single_phf<typename Builder::hasher_type, Encoder, false>>(
+            build_benchmark<single_phf<hasher_type, Encoder, false, range_reducer_type>>(
                 builder, timings, params, config);
         }
     }
@@ -156,6 +250,12 @@ void choose_encoder(build_parameters<Iterator> const& params, build_configuratio
     if (encode_all or params.encoder_type == "dictionary_dictionary") {
         choose_phf<partitioned, dictionary_dictionary>(builder, timings, params, config);
     }
+    if (encode_all or params.encoder_type == "hashed_dictionary") {
+        choose_phf<partitioned, hashed_dictionary>(builder, timings, params, config);
+    }
+    if (encode_all or params.encoder_type == "hashed_dictionary_dictionary") {
+        choose_phf<partitioned, hashed_dictionary_dictionary>(builder, timings, params, config);
+    }
     if (encode_all or params.encoder_type == "elias_fano") {
         choose_phf<partitioned, elias_fano>(builder, timings, params, config);
     }
@@ -172,35 +272,66 @@ void choose_encoder(build_parameters<Iterator> const& params, build_configuratio
     if (encode_all or params.encoder_type == "dictionary_dictionary") {
         choose_phf<partitioned, dictionary_dictionary>(builder, timings, params, config);
     }
+    if (encode_all or params.encoder_type == "hashed_dictionary_dictionary") {
+        choose_phf<partitioned, hashed_dictionary_dictionary>(builder, timings, params, config);
+    }
     if (encode_all or params.encoder_type == "elias_fano") {
         choose_phf<partitioned, elias_fano>(builder, timings, params, config);
     }
 #endif
 }
 
-template <typename Hasher, typename Iterator>
+template <typename Hasher, typename RangeReducer, typename Iterator>
 void choose_builder(build_parameters<Iterator> const& params, build_configuration const& config) {
     if (config.num_partitions > 1) {
         if (params.external_memory) {
-            choose_encoder<true, external_memory_builder_partitioned_phf<Hasher>>(params, config);
+            choose_encoder<true, external_memory_builder_partitioned_phf<Hasher, RangeReducer>>(
+                params, config);
         } else {
-            choose_encoder<true, internal_memory_builder_partitioned_phf<Hasher>>(params, config);
+            choose_encoder<true, internal_memory_builder_partitioned_phf<Hasher, RangeReducer>>(
+                params, config);
         }
     } else {
         if (params.external_memory) {
-            choose_encoder<false, external_memory_builder_single_phf<Hasher>>(params, config);
+            choose_encoder<false, external_memory_builder_single_phf<Hasher, RangeReducer>>(
+                params, config);
         } else {
-            choose_encoder<false, internal_memory_builder_single_phf<Hasher>>(params, config);
+            choose_encoder<false, internal_memory_builder_single_phf<Hasher, RangeReducer>>(
+                params, config);
         }
     }
 }
 
+template <typename Hasher, typename Iterator>
+void choose_range_reducer(build_parameters<Iterator> const& params,
+                          build_configuration const& config) {
+    bool reduce_all = (params.range_reduction == "all");
+    if (reduce_all or params.range_reduction == "fastmod") {
+        choose_builder<Hasher, fastmod_reducer>(params, config);
+    }
+    if (reduce_all or params.range_reduction == "fastrange") {
+        choose_builder<Hasher, fastrange_reducer>(params, config);
+    }
+}
+
 template <typename Iterator>
 void choose_hasher(build_parameters<Iterator> const& params, build_configuration const& config) {
     if (params.num_keys <= (uint64_t(1) << 30)) {
-        choose_builder<murmurhash2_64>(params, config);
+        if (params.hasher == "xxhash3") {
+            choose_range_reducer<xxhash3_64>(params, config);
+        } else if (params.hasher == "wyhash") {
+            choose_range_reducer<wyhash_64>(params, config);
+        } else {
+            choose_range_reducer<murmurhash2_64>(params, config);
+        }
     } else {
-        choose_builder<murmurhash2_128>(params, config);
+        if (params.hasher == "xxhash3") {
+            choose_range_reducer<xxhash3_128>(params, config);
+        } else if (params.hasher == "wyhash") {
+            choose_range_reducer<wyhash_128>(params, config);
+        } else {
+            choose_range_reducer<murmurhash2_128>(params, config);
+        }
     }
 }
 
@@ -210,15 +341,22 @@ void build(cmd_line_parser::parser const& parser, Iterator keys, uint64_t num_ke
     params.external_memory = parser.get<bool>("external_memory");
     params.check = parser.get<bool>("check");
     params.lookup = parser.get<bool>("lookup");
+    params.latency = parser.get<bool>("latency");
+    params.lookup_threads = 0;
+    if (parser.parsed("lookup_threads")) {
+        params.lookup_threads = parser.get<uint64_t>("lookup_threads");
+    }
 
     params.encoder_type = parser.get<std::string>("encoder_type");
     {
         std::unordered_set<std::string> encoders({
 #ifdef PTHASH_ENABLE_ALL_ENCODERS
             "compact", "partitioned_compact", "compact_compact", "dictionary",
-            "dictionary_dictionary", "elias_fano", "dictionary_elias_fano", "sdc", "all"
+            "dictionary_dictionary", "hashed_dictionary", "hashed_dictionary_dictionary",
+            "elias_fano", "dictionary_elias_fano", "sdc", "all"
 #else
-            "partitioned_compact", "dictionary_dictionary", "elias_fano", "all"
+            "partitioned_compact", "dictionary_dictionary", "hashed_dictionary_dictionary",
+            "elias_fano", "all"
 #endif
         });
         if (encoders.find(params.encoder_type) == encoders.end()) {
@@ -227,6 +365,26 @@ void build(cmd_line_parser::parser const& parser, Iterator keys, uint64_t num_ke
         }
     }
 
+    params.range_reduction = "fastmod";
+    if (parser.parsed("range_reduction")) {
+        params.range_reduction = parser.get<std::string>("range_reduction");
+        if (params.range_reduction != "fastmod" and params.range_reduction != "fastrange" and
+            params.range_reduction != "all") {
+            std::cerr << "unknown range reduction" << std::endl;
+            return;
+        }
+    }
+
+    params.hasher = "murmurhash2";
+    if (parser.parsed("hasher")) {
+        params.hasher = parser.get<std::string>("hasher");
+        if (params.hasher != "murmurhash2" and params.hasher != "xxhash3" and
+            params.hasher != "wyhash") {
+            std::cerr << "unknown hasher" << std::endl;
+            return;
+        }
+    }
+
     params.output_filename =
         (!parser.parsed("output_filename")) ? "" : parser.get<std::string>("output_filename");
 
@@ -235,6 +393,7 @@ void build(cmd_line_parser::parser const& parser, Iterator keys, uint64_t num_ke
     config.alpha = parser.get<double>("alpha");
     config.minimal_output = parser.get<bool>("minimal_output");
     config.verbose_output = parser.get<bool>("verbose_output");
+    config.counting_sort = parser.get<bool>("counting_sort");
 
     config.num_partitions = 1;
     if (parser.parsed("num_partitions")) {
@@ -247,15 +406,20 @@ void build(cmd_line_parser::parser const& parser, Iterator keys, uint64_t num_ke
             std::cout << "Warning: specified 0 threads, defaulting to 1" << std::endl;
             config.num_threads = 1;
         }
+        /* oversubscription is allowed (e.g., under a cgroup quota), only reported */
         uint64_t num_threads = std::thread::hardware_concurrency();
-        if (config.num_threads > num_threads) {
-            config.num_threads = num_threads;
-            std::cout << "Warning: too many threads specified, defaulting to " << config.num_threads
-                      << std::endl;
+        if (num_threads != 0 and config.num_threads > num_threads) {
+            std::cout << "Warning: " << config.num_threads << " threads specified, but only "
+                      << num_threads << " hardware threads are available" << std::endl;
         }
     }
 
     if (parser.parsed("seed")) config.seed = parser.get<uint64_t>("seed");
+    if (parser.parsed("max_pilot")) {
+        /* larger values mean no limit as well: max_pilot + 1 must not wrap around */
+        config.max_pilot =
+            std::min<uint64_t>(parser.get<uint64_t>("max_pilot"), constants::unlimited_pilot);
+    }
     if (parser.parsed("tmp_dir")) config.tmp_dir = parser.get<std::string>("tmp_dir");
 
     if (parser.parsed("ram")) {
@@ -289,11 +453,11 @@ int main(int argc, char** argv) {
                "The encoder type. Possibile values are: "
 #ifdef PTHASH_ENABLE_ALL_ENCODERS
                "'compact', 'partitioned_compact', 'compact_compact', 'dictionary', "
-               "'dictionary_dictionary', 'elias_fano', 'dictionary_elias_fano', 'sdc', "
-               "'all'.\n\t"
+               "'dictionary_dictionary', 'hashed_dictionary', 'hashed_dictionary_dictionary', "
+               "'elias_fano', 'dictionary_elias_fano', 'sdc', 'all'.\n\t"
 #else
-               "'partitioned_compact', 'dictionary_dictionary', 'elias_fano', "
-               "'all'.\n\t"
+               "'partitioned_compact', 'dictionary_dictionary', 'hashed_dictionary_dictionary', "
+               "'elias_fano', 'all'.\n\t"
                "(For more encoders, compile again with 'cmake .. -D "
                "PTHASH_ENABLE_ALL_ENCODERS=On').\n\t"
 #endif
@@ -304,27 +468,61 @@ int main(int argc, char** argv) {
     /* Optional arguments. */
     parser.add("num_partitions", "Number of partitions.", "-p", false);
     parser.add("seed", "Seed to use for construction.", "-s", false);
-    parser.add("num_threads", "Number of threads to use for construction.", "-t", false);
+    parser.add("num_threads",
+               "Number of threads to use for construction and for reading the input file.", "-t",
+               false);
     parser.add("input_filename",
                "A string input file name. If this is not provided, then num_keys 64-bit random "
                "keys will be used as input instead."
                "If, instead, the filename is '-', then input is read from standard input.",
                "-i", false);
+    parser.add("input_format",
+               "The format of the input file. Possible values are: 'text' (default, one key per "
+               "line), 'u64' (64-bit integers), 'u128' (16-byte keys, e.g., UUIDs), "
+               "'lenprefixed' (every key is preceded by its length as a 32-bit integer).\n\t"
+               "Integers are little-endian. Binary inputs are memory-mapped and never copied.",
+               "--input_format", false);
     parser.add("output_filename", "Output file name where the function will be serialized.", "-o",
                false);
+    parser.add("hasher",
+               "The hash function. Possible values are: 'murmurhash2' (default), 'xxhash3', "
+               "'wyhash'.\n\t"
+               "64-bit hash codes are used for up to 2^30 keys, 128-bit hash codes otherwise.",
+               "--hasher", false);
+    parser.add("range_reduction",
+               "How hashes are reduced to a range. Possible values are: 'fastmod' (default), "
+               "'fastrange' (multiply-shift), 'all'.\n\t"
+               "The 'all' type will just benchmark both. (Useful for benchmarking purposes.)",
+               "-r", false);
     parser.add("tmp_dir",
                "Temporary directory used for building in external memory. Default is directory '" +
                    constants::default_tmp_dirname + "'.",
                "-d", false);
     parser.add("ram", "Number of Giga bytes of RAM to use for construction in external memory.",
                "-m", false);
+    parser.add("max_pilot",
+               "Largest pilot tried for a bucket. The keys of the buckets that need a larger "
+               "pilot are bumped into a small table. Default is no limit.",
+               "--max_pilot", false);
     parser.add("minimal_output", "Build a minimal PHF.", "--minimal", false, true);
     parser.add("external_memory", "Build the function in external memory.", "--external", false,
                true);
+    parser.add("counting_sort",
+               "Group the keys into buckets with a counting sort instead of sorting "
+               "bucket-payload pairs (internal memory only).",
+               "--counting_sort", false, true);
     parser.add("verbose_output", "Verbose output during construction.", "--verbose", false, true);
     parser.add("check", "Check correctness after construction.", "--check", false, true);
     parser.add("lookup", "Measure average lookup time after construction.", "--lookup", false,
                true);
+    parser.add("latency",
+               "With --lookup, also report the percentiles of the latency of single lookups, "
+               "separately for keys that do and do not go through the free slots.",
+               "--latency", false, true);
+    parser.add("lookup_threads",
+               "With --lookup, also measure the throughput of this many threads querying the "
+               "function concurrently, with keys in input order and in shuffled order.",
+               "-l", false);
 
     if (!parser.parse()) return 1;
     if (parser.parsed("input_filename") && parser.get<std::string>("input_filename") == "-" &&
@@ -340,8 +538,53 @@ int main(int argc, char** argv) {
     auto num_keys = parser.get<uint64_t>("num_keys");
     auto seed = (parser.parsed("seed")) ? parser.get<uint64_t>("seed") : constants::invalid_seed;
     bool external_memory = parser.get<bool>("external_memory");
+    uint64_t num_threads = parser.parsed("num_threads") ? parser.get<uint64_t>("num_threads") : 1;
+    num_threads = std::max<uint64_t>(num_threads, 1);
+
+    std::string input_format = "text";
+    if (parser.parsed("input_format")) {
+        input_format = parser.get<std::string>("input_format");
+        if (input_format != "text" and input_format != "u64" and input_format != "u128" and
+            input_format != "lenprefixed") {
+            std::cerr << "unknown input format" << std::endl;
+            return 1;
+        }
+    }
 
-    if (parser.parsed("input_filename")) {
+    if (parser.parsed("input_filename") and input_format != "text") {
+        auto input_filename = parser.get<std::string>("input_filename");
+        if (input_filename == "-") {
+            std::cerr << "binary input formats cannot be read from standard input" << std::endl;
+            return 1;
+        }
+        /* the keys are read from the mapped file throughout the whole build */
+        mm::file_source<uint8_t> input(input_filename, mm::advice::sequential);
+        uint8_t const* begin = input.data();
+        uint8_t const* end = input.data() + input.size();
+        if (input_format == "u64" or input_format == "u128") {
+            uint64_t width = input_format == "u64" ? 8 : 16;
+            if (input.size() / width < num_keys) {
+                std::cerr << "the file contains only " << input.size() / width << " keys"
+                          << std::endl;
+                return 1;
+            }
+            if (width == 8) {
+                build(parser, fixed_width_iterator<8>(begin), num_keys);
+            } else {
+                build(parser, fixed_width_iterator<16>(begin), num_keys);
+            }
+        } else if (external_memory) {
+            build(parser, length_prefixed_iterator(begin, end), num_keys);
+        } else {
+            length_prefixed_collection keys(num_keys, begin, end);
+            if (keys.size() < num_keys) {
+                std::cerr << "the file contains only " << keys.size() << " keys" << std::endl;
+                return 1;
+            }
+            build(parser, keys.begin(), num_keys);
+        }
+        input.close();
+    } else if (parser.parsed("input_filename")) {
         auto input_filename = parser.get<std::string>("input_filename");
         if (external_memory) {
             if (input_filename == "-") {
@@ -354,14 +597,13 @@ int main(int argc, char** argv) {
                 input.close();
             }
         } else {
-            std::vector<std::string> keys;
+            string_pool keys;
             if (input_filename == "-") {
-                keys =
-                    read_string_collection(num_keys, std::cin, parser.get<bool>("verbose_output"));
+                keys = read_string_pool(num_keys, std::cin, parser.get<bool>("verbose_output"));
             } else {
-                std::ifstream input(input_filename.c_str());
-                if (!input.good()) throw std::runtime_error("error in opening file.");
-                keys = read_string_collection(num_keys, input, parser.get<bool>("verbose_output"));
+                mm::file_source<uint8_t> input(input_filename, mm::advice::sequential);
+                keys = read_string_pool(num_keys, input.data(), input.data() + input.size(),
+                                        num_threads, parser.get<bool>("verbose_output"));
                 input.close();
             }
             build(parser, keys.begin(), keys.size());
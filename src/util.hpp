@@ -1,45 +1,108 @@
 #pragma once
 
 #include <chrono>
+#include <cstring>  // for memchr
 #include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <iterator>
+#include <numeric>  // for iota
+#include <random>
 #include <sstream>  // for stringbuf
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 #include "include/utils/util.hpp"
+#include "include/utils/hasher.hpp"
 #include "essentials.hpp"
 
 namespace pthash {
 
+/*
+    Boundaries chunks[0] = begin < chunks[1] < ... < chunks.back() = end of at most
+    num_chunks chunks of [begin, end) of roughly the same size, each made of whole lines.
+*/
+inline std::vector<uint8_t const*> line_chunks(uint8_t const* begin, uint8_t const* end,
+                                               uint64_t num_chunks) {
+    std::vector<uint8_t const*> chunks(1, begin);
+    uint64_t chunk_size = (end - begin + num_chunks - 1) / num_chunks;
+    while (chunks.back() != end) {
+        uint8_t const* p = chunks.back() + std::min<uint64_t>(chunk_size, end - chunks.back());
+        if (p != end) {
+            /* move the boundary past the end of the line it falls in */
+            uint8_t const* newline =
+                static_cast<uint8_t const*>(std::memchr(p - 1, '\n', end - p + 1));
+            p = newline ? newline + 1 : end;
+        }
+        chunks.push_back(p);
+    }
+    return chunks;
+}
+
+/* Number of lines in each chunk, counted in parallel. The last line may lack the newline. */
+inline std::vector<uint64_t> count_lines(std::vector<uint8_t const*> const& chunks) {
+    uint64_t num_chunks = chunks.size() - 1;
+    std::vector<uint64_t> num_lines(num_chunks);
+    auto exe = [&](uint64_t i) {
+        num_lines[i] = std::count(chunks[i], chunks[i + 1], '\n');
+        if (chunks[i + 1] != chunks[i] and chunks[i + 1][-1] != '\n') ++num_lines[i];
+    };
+    std::vector<std::thread> threads;
+    threads.reserve(num_chunks);
+    for (uint64_t i = 0; i != num_chunks; ++i) threads.emplace_back(exe, i);
+    for (auto& t : threads) t.join();
+    return num_lines;
+}
+
+/*
+    Line numbers, counted from begin, of the first two empty lines among the first
+    num_lines lines of [begin, end). The range must start at the beginning of a line.
+*/
+inline std::vector<uint64_t> first_empty_lines(uint8_t const* begin, uint8_t const* end,
+                                               uint64_t num_lines) {
+    std::vector<uint64_t> empty_lines;
+    for (uint64_t i = 0; i != num_lines and empty_lines.size() != 2; ++i) {
+        uint8_t const* newline =
+            static_cast<uint8_t const*>(std::memchr(begin, '\n', end - begin));
+        if (newline == begin) empty_lines.push_back(i);
+        begin = newline ? newline + 1 : end;
+    }
+    return empty_lines;
+}
+
+/*
+    Iterates over the lines of a memory-mapped file. Keys are yielded as byte ranges
+    pointing into the mapped data, so that no key is ever copied. The end of the data
+    also ends the last line, which may lack the newline.
+*/
 struct lines_iterator : std::forward_iterator_tag {
-    typedef std::string value_type;
+    typedef byte_range value_type;
 
     lines_iterator(uint8_t const* begin, uint8_t const* end)
         : m_begin(begin), m_end(end), m_num_lines(0), m_num_empty_lines(0) {}
 
-    std::string operator*() {
+    byte_range operator*() {
+        if (m_begin == m_end) {
+            throw std::runtime_error("reached end of file after " + std::to_string(m_num_lines) +
+                                     " lines");
+        }
+
         uint8_t const* begin = m_begin;
-        while (m_begin != m_end and *m_begin++ != '\n')
-            ;
+        uint8_t const* newline =
+            static_cast<uint8_t const*>(std::memchr(m_begin, '\n', m_end - m_begin));
+        uint8_t const* line_end = newline ? newline : m_end;
+        m_begin = newline ? newline + 1 : m_end;
 
-        if (m_begin <= begin + 1) {
-            std::stringbuf buffer;
-            std::ostream os(&buffer);
-            if (m_begin == m_end) {
-                os << "reached end of file after " << m_num_lines << " lines";
-            } else {
-                os << "second blank line detected after " << m_num_lines << " lines";
-                ++m_num_empty_lines;
-            }
-            /* does not allow more than 1 empty key */
-            if (m_num_empty_lines > 1 or m_begin == m_end) throw std::runtime_error(buffer.str());
+        /* does not allow more than 1 empty key */
+        if (line_end == begin and ++m_num_empty_lines > 1) {
+            throw std::runtime_error("second blank line detected after " +
+                                     std::to_string(m_num_lines) + " lines");
         }
 
         ++m_num_lines;
-        return std::string(reinterpret_cast<const char*>(begin), m_begin - begin - 1);
+        return {begin, line_end};
     }
 
     void operator++(int) const {}
@@ -48,6 +111,60 @@ struct lines_iterator : std::forward_iterator_tag {
         throw std::runtime_error("lines_iterator::operator+(uint64_t) has not been implemented");
     }
 
+    /*
+        Split the next num_lines lines into at most num_chunks iterators over consecutive
+        lines, each paired with the number of lines it covers, so that the lines can be
+        read from several threads. The lines are counted in parallel, and the empty lines
+        are counted over all the chunks, so that the input is checked as when reading it
+        with a single iterator.
+    */
+    std::vector<std::pair<lines_iterator, uint64_t>> split(uint64_t num_lines,
+                                                           uint64_t num_chunks) const {
+        auto chunks = line_chunks(m_begin, m_end, num_chunks);
+        auto chunk_lines = count_lines(chunks);
+        num_chunks = chunk_lines.size();
+
+        std::vector<uint64_t> first_line(num_chunks);
+        uint64_t remaining = num_lines;
+        for (uint64_t i = 0; i != num_chunks; ++i) {
+            first_line[i] = num_lines - remaining;
+            chunk_lines[i] = std::min(chunk_lines[i], remaining);
+            remaining -= chunk_lines[i];
+        }
+
+        std::vector<std::vector<uint64_t>> empty_lines(num_chunks);
+        auto exe = [&](uint64_t i) {
+            empty_lines[i] = first_empty_lines(chunks[i], chunks[i + 1], chunk_lines[i]);
+        };
+        std::vector<std::thread> threads;
+        threads.reserve(num_chunks);
+        for (uint64_t i = 0; i != num_chunks; ++i) threads.emplace_back(exe, i);
+        for (auto& t : threads) t.join();
+        uint64_t num_empty_lines = m_num_empty_lines;
+        for (uint64_t i = 0; i != num_chunks; ++i) {
+            for (uint64_t line : empty_lines[i]) {
+                /* does not allow more than 1 empty key */
+                if (++num_empty_lines > 1) {
+                    throw std::runtime_error("second blank line detected after " +
+                                             std::to_string(m_num_lines + first_line[i] + line) +
+                                             " lines");
+                }
+            }
+        }
+
+        std::vector<std::pair<lines_iterator, uint64_t>> result;
+        for (uint64_t i = 0; i != num_chunks; ++i) {
+            if (chunk_lines[i] == 0) continue;
+            result.emplace_back(lines_iterator(chunks[i], chunks[i + 1]), chunk_lines[i]);
+        }
+        if (remaining != 0) {
+            throw std::runtime_error("reached end of file after " +
+                                     std::to_string(m_num_lines + num_lines - remaining) +
+                                     " lines");
+        }
+        return result;
+    }
+
 private:
     uint8_t const* m_begin;
     uint8_t const* m_end;
@@ -55,13 +172,17 @@ private:
     uint64_t m_num_empty_lines;
 };
 
+/*
+    Iterates over the lines of a stream. The yielded byte range points into an
+    internal buffer and is only valid until the next call to operator*.
+*/
 struct sequential_lines_iterator : std::forward_iterator_tag {
-    typedef std::string value_type;
+    typedef byte_range value_type;
 
     sequential_lines_iterator(std::istream& is)
         : m_pis(&is), m_num_lines(0), m_num_empty_lines(0) {}
 
-    std::string operator*()  //
+    byte_range operator*()  //
     {
         std::getline(*m_pis, m_key);
 
@@ -79,7 +200,8 @@ struct sequential_lines_iterator : std::forward_iterator_tag {
         }
 
         ++m_num_lines;
-        return m_key;
+        uint8_t const* begin = reinterpret_cast<uint8_t const*>(m_key.data());
+        return {begin, begin + m_key.size()};
     }
 
     void operator++(int) const {}
@@ -96,33 +218,364 @@ private:
     std::string m_key;
 };
 
+/*
+    A collection of strings packed one after the other in a single buffer,
+    delimited by an array of num_strings + 1 offsets. Compared to a
+    std::vector<std::string>, it saves a heap allocation and the std::string
+    overhead per key. Strings are accessed as byte ranges.
+*/
+struct string_pool {
+    struct iterator {
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef byte_range value_type;
+        typedef int64_t difference_type;
+        typedef byte_range const* pointer;
+        typedef byte_range reference;
+
+        iterator() : m_pool(nullptr), m_i(0) {}
+        iterator(string_pool const* pool, uint64_t i) : m_pool(pool), m_i(i) {}
+
+        byte_range operator*() const {
+            return (*m_pool)[m_i];
+        }
+
+        byte_range operator[](uint64_t offset) const {
+            return (*m_pool)[m_i + offset];
+        }
+
+        iterator& operator++() {
+            ++m_i;
+            return *this;
+        }
+
+        iterator operator+(uint64_t offset) const {
+            return iterator(m_pool, m_i + offset);
+        }
+
+        bool operator==(iterator const& rhs) const {
+            return m_i == rhs.m_i;
+        }
+
+        bool operator!=(iterator const& rhs) const {
+            return m_i != rhs.m_i;
+        }
+
+    private:
+        string_pool const* m_pool;
+        uint64_t m_i;
+    };
+
+    string_pool() : m_offsets(1, 0) {}
+
+    /* Take the packed strings and the num_strings + 1 offsets delimiting them. */
+    string_pool(std::vector<uint8_t>&& data, std::vector<uint64_t>&& offsets)
+        : m_data(std::move(data)), m_offsets(std::move(offsets)) {
+        assert(!m_offsets.empty() and m_offsets.back() == m_data.size());
+    }
+
+    void reserve(uint64_t num_strings, uint64_t num_bytes) {
+        m_offsets.reserve(num_strings + 1);
+        m_data.reserve(num_bytes);
+    }
+
+    void push_back(uint8_t const* begin, uint8_t const* end) {
+        m_data.insert(m_data.end(), begin, end);
+        m_offsets.push_back(m_data.size());
+    }
+
+    void shrink_to_fit() {
+        m_offsets.shrink_to_fit();
+        m_data.shrink_to_fit();
+    }
+
+    byte_range operator[](uint64_t i) const {
+        assert(i < size());
+        return {m_data.data() + m_offsets[i], m_data.data() + m_offsets[i + 1]};
+    }
+
+    uint64_t size() const {
+        return m_offsets.size() - 1;
+    }
+
+    uint64_t num_bytes() const {
+        return m_data.size();
+    }
+
+    iterator begin() const {
+        return iterator(this, 0);
+    }
+
+    iterator end() const {
+        return iterator(this, size());
+    }
+
+private:
+    std::vector<uint8_t> m_data;
+    std::vector<uint64_t> m_offsets;
+};
+
+inline void print_string_pool_stats(string_pool const& strings) {
+    uint64_t max_string_length = 0;
+    for (uint64_t i = 0; i != strings.size(); ++i) {
+        byte_range s = strings[i];
+        max_string_length = std::max<uint64_t>(max_string_length, s.end - s.begin);
+    }
+    std::cout << "num_strings " << strings.size() << std::endl;
+    std::cout << "max_string_length " << max_string_length << std::endl;
+    std::cout << "total_length " << strings.num_bytes() << std::endl;
+    std::cout << "avg_string_length " << std::fixed << std::setprecision(2)
+              << static_cast<double>(strings.num_bytes()) / strings.size() << std::endl;
+}
+
+/* Read at most n newline-terminated strings from the stream. */
 template <typename IStream>
-std::vector<std::string> read_string_collection(uint64_t n, IStream& is, bool verbose) {
+string_pool read_string_pool(uint64_t n, IStream& is, bool verbose) {
     progress_logger logger(n, "read ", " keys from file", verbose);
     std::string s;
-    uint64_t max_string_length = 0;
-    uint64_t sum_of_lengths = 0;
-    std::vector<std::string> strings;
-    strings.reserve(n);
+    string_pool strings;
+    strings.reserve(n, 0);
     while (std::getline(is, s)) {
-        if (s.size() > max_string_length) max_string_length = s.size();
-        sum_of_lengths += s.size();
-        strings.push_back(s);
+        uint8_t const* begin = reinterpret_cast<uint8_t const*>(s.data());
+        strings.push_back(begin, begin + s.size());
         logger.log();
         if (strings.size() == n) break;
     }
     strings.shrink_to_fit();
     logger.finalize();
+    if (verbose) print_string_pool_stats(strings);
+    return strings;
+}
+
+/*
+    Read at most n newline-terminated strings from the bytes in [begin, end), e.g.,
+    a memory-mapped file, using num_threads threads. The bytes are split into chunks
+    of whole lines: each thread counts the lines of its chunk, then copies them into
+    the pool. Since the i-th line is preceded by exactly i newlines, it starts at
+    offset (position in the input - i) in the pool.
+*/
+inline string_pool read_string_pool(uint64_t n, uint8_t const* begin, uint8_t const* end,
+                                    uint64_t num_threads, bool verbose) {
     if (verbose) {
-        std::cout << "num_strings " << strings.size() << std::endl;
-        std::cout << "max_string_length " << max_string_length << std::endl;
-        std::cout << "total_length " << sum_of_lengths << std::endl;
-        std::cout << "avg_string_length " << std::fixed << std::setprecision(2)
-                  << static_cast<double>(sum_of_lengths) / strings.size() << std::endl;
+        essentials::logger("reading keys with " + std::to_string(num_threads) + " threads");
+    }
+    auto chunks = line_chunks(begin, end, std::max<uint64_t>(num_threads, 1));
+    auto chunk_lines = count_lines(chunks);
+
+    std::vector<uint64_t> first_line(chunk_lines.size());
+    uint64_t num_lines = 0;
+    for (uint64_t i = 0; i != chunk_lines.size(); ++i) {
+        first_line[i] = num_lines;
+        chunk_lines[i] = std::min(chunk_lines[i], n - num_lines);
+        num_lines += chunk_lines[i];
     }
+
+    std::vector<uint8_t> data(end - begin);
+    std::vector<uint64_t> offsets(num_lines + 1, 0);
+    auto exe = [&](uint64_t i) {
+        uint8_t const* p = chunks[i];
+        uint8_t const* chunk_end = chunks[i + 1];
+        for (uint64_t j = first_line[i]; j != first_line[i] + chunk_lines[i]; ++j) {
+            uint8_t const* newline =
+                static_cast<uint8_t const*>(std::memchr(p, '\n', chunk_end - p));
+            uint8_t const* line_end = newline ? newline : chunk_end;
+            offsets[j] = (p - begin) - j;
+            std::memcpy(data.data() + offsets[j], p, line_end - p);
+            if (j + 1 == num_lines) offsets[num_lines] = (line_end - begin) - j;
+            p = line_end + 1;
+        }
+    };
+    std::vector<std::thread> threads;
+    threads.reserve(chunk_lines.size());
+    for (uint64_t i = 0; i != chunk_lines.size(); ++i) threads.emplace_back(exe, i);
+    for (auto& t : threads) t.join();
+
+    data.resize(offsets.back());
+    data.shrink_to_fit();
+    string_pool strings(std::move(data), std::move(offsets));
+    if (verbose) print_string_pool_stats(strings);
     return strings;
 }
 
+/*
+    Random-access iterator over the records of a binary file of Width-byte keys, e.g.,
+    memory-mapped. 8-byte keys are yielded as (little-endian) uint64_t, so that they are
+    hashed like integers; other widths are yielded as byte ranges into the data.
+*/
+template <uint64_t Width>
+struct fixed_width_iterator {
+    typedef std::random_access_iterator_tag iterator_category;
+    typedef std::conditional_t<Width == sizeof(uint64_t), uint64_t, byte_range> value_type;
+    typedef int64_t difference_type;
+    typedef value_type const* pointer;
+    typedef value_type reference;
+
+    fixed_width_iterator() : m_data(nullptr) {}
+    fixed_width_iterator(uint8_t const* data) : m_data(data) {}
+
+    value_type operator*() const {
+        if constexpr (Width == sizeof(uint64_t)) {
+            uint64_t val;
+            std::memcpy(&val, m_data, sizeof(uint64_t));
+            return val;
+        } else {
+            return {m_data, m_data + Width};
+        }
+    }
+
+    value_type operator[](uint64_t offset) const {
+        return *(*this + offset);
+    }
+
+    fixed_width_iterator& operator++() {
+        m_data += Width;
+        return *this;
+    }
+
+    fixed_width_iterator operator+(uint64_t offset) const {
+        return fixed_width_iterator(m_data + offset * Width);
+    }
+
+    std::vector<std::pair<fixed_width_iterator, uint64_t>> split(uint64_t num_keys,
+                                                                 uint64_t num_chunks) const {
+        std::vector<std::pair<fixed_width_iterator, uint64_t>> result;
+        uint64_t chunk_size = (num_keys + num_chunks - 1) / num_chunks;
+        for (uint64_t begin = 0; begin < num_keys; begin += chunk_size) {
+            result.emplace_back(*this + begin, std::min(chunk_size, num_keys - begin));
+        }
+        return result;
+    }
+
+private:
+    uint8_t const* m_data;
+};
+
+/*
+    Iterates over a binary file of length-prefixed keys: every key is a 32-bit
+    little-endian length followed by that many bytes. Keys are yielded as byte
+    ranges pointing into the data.
+*/
+struct length_prefixed_iterator : std::forward_iterator_tag {
+    typedef byte_range value_type;
+    static constexpr uint64_t prefix_size = sizeof(uint32_t);
+
+    length_prefixed_iterator(uint8_t const* begin, uint8_t const* end)
+        : m_begin(begin), m_end(end) {}
+
+    byte_range operator*() {
+        byte_range key = record(m_begin, m_end);
+        m_begin = key.end;
+        return key;
+    }
+
+    void operator++(int) const {}
+    void operator++() const {}
+    length_prefixed_iterator operator+(uint64_t) const {
+        throw std::runtime_error(
+            "length_prefixed_iterator::operator+(uint64_t) has not been implemented");
+    }
+
+    /*
+        Split the next num_keys keys into at most num_chunks iterators over consecutive
+        keys, each paired with the number of keys it covers. Since the boundaries of
+        the keys are only known from their prefixes, this walks the prefixes.
+    */
+    std::vector<std::pair<length_prefixed_iterator, uint64_t>> split(uint64_t num_keys,
+                                                                     uint64_t num_chunks) const {
+        std::vector<std::pair<length_prefixed_iterator, uint64_t>> result;
+        uint64_t chunk_size = (num_keys + num_chunks - 1) / num_chunks;
+        uint8_t const* p = m_begin;
+        for (uint64_t begin = 0; begin < num_keys; begin += chunk_size) {
+            uint64_t n = std::min(chunk_size, num_keys - begin);
+            result.emplace_back(length_prefixed_iterator(p, m_end), n);
+            for (uint64_t i = 0; i != n; ++i) p = record(p, m_end).end;
+        }
+        return result;
+    }
+
+    /* The key whose prefix starts at p. */
+    static byte_range record(uint8_t const* p, uint8_t const* end) {
+        uint32_t length;
+        if (static_cast<uint64_t>(end - p) < prefix_size) {
+            throw std::runtime_error("reached end of file");
+        }
+        std::memcpy(&length, p, prefix_size);
+        if (static_cast<uint64_t>(end - p) - prefix_size < length) {
+            throw std::runtime_error("truncated key at the end of file");
+        }
+        return {p + prefix_size, p + prefix_size + length};
+    }
+
+private:
+    uint8_t const* m_begin;
+    uint8_t const* m_end;
+};
+
+/*
+    Random access to the first num_keys length-prefixed keys of [begin, end)
+    through the positions of their prefixes: the keys themselves are not copied.
+*/
+struct length_prefixed_collection {
+    struct iterator {
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef byte_range value_type;
+        typedef int64_t difference_type;
+        typedef byte_range const* pointer;
+        typedef byte_range reference;
+
+        iterator() : m_collection(nullptr), m_i(0) {}
+        iterator(length_prefixed_collection const* collection, uint64_t i)
+            : m_collection(collection), m_i(i) {}
+
+        byte_range operator*() const {
+            return (*m_collection)[m_i];
+        }
+
+        byte_range operator[](uint64_t offset) const {
+            return (*m_collection)[m_i + offset];
+        }
+
+        iterator& operator++() {
+            ++m_i;
+            return *this;
+        }
+
+        iterator operator+(uint64_t offset) const {
+            return iterator(m_collection, m_i + offset);
+        }
+
+    private:
+        length_prefixed_collection const* m_collection;
+        uint64_t m_i;
+    };
+
+    length_prefixed_collection(uint64_t num_keys, uint8_t const* begin, uint8_t const* end)
+        : m_data(begin), m_end(end) {
+        m_offsets.reserve(num_keys);
+        for (uint8_t const* p = begin; p != end and m_offsets.size() != num_keys;) {
+            m_offsets.push_back(p - begin);
+            p = length_prefixed_iterator::record(p, end).end;
+        }
+    }
+
+    byte_range operator[](uint64_t i) const {
+        assert(i < size());
+        return length_prefixed_iterator::record(m_data + m_offsets[i], m_end);
+    }
+
+    uint64_t size() const {
+        return m_offsets.size();
+    }
+
+    iterator begin() const {
+        return iterator(this, 0);
+    }
+
+private:
+    uint8_t const* m_data;
+    uint8_t const* m_end;
+    std::vector<uint64_t> m_offsets;
+};
+
 template <typename Uint>
 std::vector<Uint> distinct_keys(uint64_t num_keys, uint64_t seed = constants::invalid_seed) {
     assert(num_keys > 0);
@@ -210,4 +663,147 @@ double perf(Iterator keys, uint64_t num_keys, Function const& f) {
     return nanosec_per_key;
 }
 
-}  // namespace pthash
\ No newline at end of file
+template <typename Function, typename Iterator>
+double perf_batch(Iterator keys, uint64_t num_keys, Function const& f) {
+    static const uint64_t runs = 5;
+    uint64_t positions[lookup_batch_size];
+    essentials::timer<std::chrono::high_resolution_clock, std::chrono::nanoseconds> t;
+    t.start();
+    for (uint64_t r = 0; r != runs; ++r) {
+        for (uint64_t i = 0; i < num_keys; i += lookup_batch_size) {
+            uint64_t size = std::min<uint64_t>(num_keys - i, lookup_batch_size);
+            f.lookup_batch(keys + i, size, positions);
+            essentials::do_not_optimize_away(positions[size - 1]);
+        }
+    }
+    t.stop();
+    double nanosec_per_key = t.elapsed() / static_cast<double>(runs * num_keys);
+    return nanosec_per_key;
+}
+
+struct parallel_perf_result {
+    double queries_per_sec;  // aggregate over all threads
+    double nanosec_per_key;  // average over the threads
+};
+
+/*
+    Lookups from num_threads threads sharing f. Every thread queries all keys:
+    in input order, or in a random order if shuffled. Each thread starts at a
+    different key, so that the threads do not walk the keys in lock-step.
+    Requires a random-access iterator.
+*/
+template <typename Function, typename Iterator>
+parallel_perf_result perf_parallel(Iterator keys, uint64_t num_keys, Function const& f,
+                                   uint64_t num_threads, bool shuffled) {
+    static const uint64_t runs = 5;
+    assert(num_threads > 0);
+
+    std::vector<uint64_t> order;
+    if (shuffled) {
+        order.resize(num_keys);
+        std::iota(order.begin(), order.end(), 0);
+        std::shuffle(order.begin(), order.end(), std::mt19937_64(num_keys));
+    }
+
+    std::vector<double> thread_nanosec(num_threads);
+    auto exe = [&](uint64_t thread_id) {
+        uint64_t start = (num_keys / num_threads) * thread_id;
+        essentials::timer<std::chrono::high_resolution_clock, std::chrono::nanoseconds> t;
+        t.start();
+        for (uint64_t r = 0; r != runs; ++r) {
+            for (uint64_t i = 0, j = start; i != num_keys; ++i) {
+                uint64_t p = f(*(keys + (shuffled ? order[j] : j)));
+                essentials::do_not_optimize_away(p);
+                if (++j == num_keys) j = 0;
+            }
+        }
+        t.stop();
+        thread_nanosec[thread_id] = t.elapsed();
+    };
+
+    essentials::timer<std::chrono::high_resolution_clock, std::chrono::nanoseconds> t;
+    t.start();
+    std::vector<std::thread> threads;
+    threads.reserve(num_threads);
+    for (uint64_t i = 0; i != num_threads; ++i) threads.emplace_back(exe, i);
+    for (auto& thread : threads) thread.join();
+    t.stop();
+
+    double num_queries = static_cast<double>(runs * num_keys);
+    parallel_perf_result result;
+    result.queries_per_sec = (num_threads * num_queries) / (t.elapsed() / 1000000000.0);
+    result.nanosec_per_key = 0.0;
+    for (auto nanosec : thread_nanosec) result.nanosec_per_key += nanosec / num_queries;
+    result.nanosec_per_key /= num_threads;
+    return result;
+}
+
+struct latency_percentiles {
+    latency_percentiles() : num_samples(0), p50(0), p90(0), p99(0), p999(0) {}
+
+    uint64_t num_samples;
+    double p50, p90, p99, p999;  // nanoseconds
+};
+
+/*
+    Distribution of the latency of single lookups, split between the lookups that
+    end in [0, num_keys()) and those that go through the free slots.
+    At most max_samples keys, evenly spaced in the input, are timed one at a time with
+    steady_clock (clock_gettime); the overhead of reading the clock is subtracted.
+    Requires a random-access iterator.
+*/
+template <typename Function, typename Iterator>
+std::pair<latency_percentiles, latency_percentiles> perf_latency(Iterator keys, uint64_t num_keys,
+                                                                 Function const& f) {
+    typedef std::chrono::steady_clock clock_type;
+    static const uint64_t max_samples = 1000000;
+    uint64_t num_samples = std::min(num_keys, max_samples);
+
+    auto nanosec = [](clock_type::time_point start, clock_type::time_point stop) {
+        return static_cast<double>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count());
+    };
+
+    std::vector<double> overhead(1000);
+    for (auto& x : overhead) {
+        auto start = clock_type::now();
+        auto stop = clock_type::now();
+        x = nanosec(start, stop);
+    }
+    std::sort(overhead.begin(), overhead.end());
+    double clock_overhead = overhead[overhead.size() / 2];
+
+    std::vector<double> fast_path, free_slot_path;
+    for (uint64_t i = 0; i != num_samples; ++i) {
+        auto const& key = *(keys + (i * num_keys) / num_samples);
+        auto start = clock_type::now();
+        uint64_t p = f(key);
+        essentials::do_not_optimize_away(p);
+        auto stop = clock_type::now();
+        double elapsed = std::max(0.0, nanosec(start, stop) - clock_overhead);
+        if (f.maps_to_free_slot(key)) {
+            free_slot_path.push_back(elapsed);
+        } else {
+            fast_path.push_back(elapsed);
+        }
+    }
+
+    auto percentiles = [](std::vector<double>& samples) {
+        latency_percentiles result;
+        result.num_samples = samples.size();
+        if (samples.empty()) return result;
+        std::sort(samples.begin(), samples.end());
+        auto at = [&](double q) {
+            return samples[static_cast<uint64_t>(q * (samples.size() - 1))];
+        };
+        result.p50 = at(0.5);
+        result.p90 = at(0.9);
+        result.p99 = at(0.99);
+        result.p999 = at(0.999);
+        return result;
+    };
+
+    return {percentiles(fast_path), percentiles(free_slot_path)};
+}
+
+}  // namespace pthash
@@ -16,4 +16,22 @@ void require_equal(T const& got, T const& required) {
     }
 }
 
+/*
+    Random 128-bit hashes, except for MAX_BUCKET_SIZE + 1 of them that fall into the same
+    partition (out of num_partitions, with fastmod) and the same bucket: the partition
+    cannot be built with the global seed, whatever the seed.
+*/
+inline std::vector<hash128> hashes_with_overfull_bucket(uint64_t num_keys, uint64_t num_partitions,
+                                                        uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::vector<hash128> hashes;
+    hashes.reserve(num_keys);
+    uint64_t first = rng();
+    for (uint64_t k = 1; k <= MAX_BUCKET_SIZE + 1; ++k) {
+        hashes.emplace_back(first, first ^ (k * num_partitions));  // mix() = k * num_partitions
+    }
+    while (hashes.size() != num_keys) hashes.emplace_back(rng(), rng());
+    return hashes;
+}
+
 }  // namespace pthash::testing
\ No newline at end of file
@@ -5,10 +5,16 @@ using namespace pthash;
 template <typename Encoder, typename Builder, typename Iterator>
 void test_encoder(Builder& builder, build_configuration const& config, Iterator keys,
                   uint64_t num_keys) {
-    partitioned_phf<typename Builder::hasher_type, Encoder, true> f;
+    typedef typename Builder::hasher_type hasher_type;
+    typedef typename Builder::range_reducer_type range_reducer_type;
+    partitioned_phf<hasher_type, Encoder, true, range_reducer_type> f;
     f.build(builder, config);
     testing::require_equal(f.num_keys(), num_keys);
     check(keys, f);
+
+    std::vector<uint64_t> positions(num_keys);
+    f.lookup_batch(keys, num_keys, positions.data());
+    for (uint64_t i = 0; i != num_keys; ++i) testing::require_equal(positions[i], f(keys[i]));
 }
 
 template <typename Iterator>
@@ -17,12 +23,17 @@ void test_internal_memory_partitioned_mphf(Iterator keys, uint64_t num_keys) {
 
     internal_memory_builder_partitioned_phf<murmurhash2_64> builder_64;
     internal_memory_builder_partitioned_phf<murmurhash2_128> builder_128;
+    internal_memory_builder_partitioned_phf<murmurhash2_64, fastrange_reducer> builder_fastrange_64;
+    internal_memory_builder_partitioned_phf<murmurhash2_128, fastrange_reducer>
+        builder_fastrange_128;
 
     build_configuration config;
     config.minimal_output = true;  // mphf
     config.verbose_output = false;
     config.seed = random_value();
 
+    thread_pool pool(4);
+
     std::vector<uint64_t> num_partitions{1, 16, 32, 64};
     std::vector<double> C{4.0, 4.5, 5.0, 5.5, 6.0};
     std::vector<double> A{1.0, 0.99, 0.98, 0.97, 0.96};
@@ -43,6 +54,8 @@ void test_internal_memory_partitioned_mphf(Iterator keys, uint64_t num_keys) {
                 test_encoder<compact_compact>(builder_64, config, keys, num_keys);
                 test_encoder<dictionary>(builder_64, config, keys, num_keys);
                 test_encoder<dictionary_dictionary>(builder_64, config, keys, num_keys);
+                test_encoder<hashed_dictionary>(builder_64, config, keys, num_keys);
+                test_encoder<hashed_dictionary_dictionary>(builder_64, config, keys, num_keys);
                 test_encoder<elias_fano>(builder_64, config, keys, num_keys);
                 test_encoder<dictionary_elias_fano>(builder_64, config, keys, num_keys);
                 test_encoder<sdc>(builder_64, config, keys, num_keys);
@@ -53,15 +66,101 @@ void test_internal_memory_partitioned_mphf(Iterator keys, uint64_t num_keys) {
                 test_encoder<compact_compact>(builder_128, config, keys, num_keys);
                 test_encoder<dictionary>(builder_128, config, keys, num_keys);
                 test_encoder<dictionary_dictionary>(builder_128, config, keys, num_keys);
+                test_encoder<hashed_dictionary>(builder_128, config, keys, num_keys);
+                test_encoder<hashed_dictionary_dictionary>(builder_128, config, keys, num_keys);
                 test_encoder<elias_fano>(builder_128, config, keys, num_keys);
                 test_encoder<dictionary_elias_fano>(builder_128, config, keys, num_keys);
                 test_encoder<sdc>(builder_128, config, keys, num_keys);
+
+                builder_fastrange_64.build_from_keys(keys, num_keys, config);
+                test_encoder<dictionary_dictionary>(builder_fastrange_64, config, keys, num_keys);
+                test_encoder<elias_fano>(builder_fastrange_64, config, keys, num_keys);
+
+                builder_fastrange_128.build_from_keys(keys, num_keys, config);
+                test_encoder<dictionary_dictionary>(builder_fastrange_128, config, keys, num_keys);
+                test_encoder<elias_fano>(builder_fastrange_128, config, keys, num_keys);
+
+                config.num_threads = 4;  // partitions built and encoded on the same threads
+                config.pool = &pool;
+                builder_64.build_from_keys(keys, num_keys, config);
+                test_encoder<dictionary_dictionary>(builder_64, config, keys, num_keys);
+                config.num_threads = 1;
+                config.pool = nullptr;
             }
         }
     }
 }
 
+/* A partition on which the global seed fails is rebuilt alone, with a seed of its own. */
+void test_partition_reseeding() {
+    static const uint64_t num_keys = 100000;
+    static const uint64_t num_partitions = 4;
+    std::cout << "testing partition reseeding..." << std::endl;
+
+    auto hashes = testing::hashes_with_overfull_bucket(num_keys, num_partitions, random_value());
+    build_configuration config;
+    config.minimal_output = true;  // mphf
+    config.verbose_output = false;
+    config.seed = random_value();
+    config.num_partitions = num_partitions;
+
+    for (uint64_t num_threads : {1, 2}) {
+        config.num_threads = num_threads;
+        internal_memory_builder_partitioned_phf<murmurhash2_128> builder;
+        builder.build_from_hashes(hashes.begin(), num_keys, config);
+        partitioned_phf<murmurhash2_128, dictionary_dictionary, true> f;
+        f.build(builder, config);
+
+        /* the overfull bucket is in partition 0: only this partition is reseeded */
+        testing::require_equal(f.partition_function(0).seed() != f.seed(), true);
+        for (uint64_t i = 1; i != num_partitions; ++i) {
+            testing::require_equal(f.partition_function(i).seed(), f.seed());
+        }
+
+        std::vector<bool> taken(num_keys, false);
+        for (auto const& hash : hashes) {
+            uint64_t p = f.position(hash);
+            testing::require_equal(p < num_keys and !taken[p], true);
+            taken[p] = true;
+        }
+        std::vector<uint64_t> positions(num_keys);
+        f.position_batch(hashes.data(), num_keys, positions.data());
+        for (uint64_t i = 0; i != num_keys; ++i) {
+            testing::require_equal(positions[i], f.position(hashes[i]));
+        }
+    }
+}
+
+/*
+    A duplicate key has the same 64-bit hash under every seed: reseeding its partition
+    cannot help, so the build fails at once with seed_runtime_error.
+*/
+void test_duplicate_key() {
+    static const uint64_t num_keys = 100000;
+    std::cout << "testing a duplicate key..." << std::endl;
+
+    std::vector<uint64_t> keys = distinct_keys<uint64_t>(num_keys, random_value());
+    keys.push_back(keys.front());
+    build_configuration config;
+    config.minimal_output = true;  // mphf
+    config.verbose_output = false;
+    config.seed = random_value();
+    config.num_partitions = 4;
+
+    internal_memory_builder_partitioned_phf<murmurhash2_64> builder;
+    bool thrown = false;
+    try {
+        builder.build_from_keys(keys.begin(), keys.size(), config);
+    } catch (seed_runtime_error const&) {
+        thrown = true;
+    }
+    testing::require_equal(thrown, true);
+}
+
 int main() {
+    test_partition_reseeding();
+    test_duplicate_key();
+
     static const uint64_t universe = 1000000;
     for (int i = 0; i != 5; ++i) {
         uint64_t num_keys = random_value() % universe;
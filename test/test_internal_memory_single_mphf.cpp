@@ -5,10 +5,16 @@ using namespace pthash;
 template <typename Encoder, typename Builder, typename Iterator>
 void test_encoder(Builder const& builder, build_configuration const& config, Iterator keys,
                   uint64_t num_keys) {
-    single_phf<typename Builder::hasher_type, Encoder, true> f;
+    typedef typename Builder::hasher_type hasher_type;
+    typedef typename Builder::range_reducer_type range_reducer_type;
+    single_phf<hasher_type, Encoder, true, range_reducer_type> f;
     f.build(builder, config);
     testing::require_equal(f.num_keys(), num_keys);
     check(keys, f);
+
+    std::vector<uint64_t> positions(num_keys);
+    f.lookup_batch(keys, num_keys, positions.data());
+    for (uint64_t i = 0; i != num_keys; ++i) testing::require_equal(positions[i], f(keys[i]));
 }
 
 template <typename Iterator>
@@ -17,12 +23,20 @@ void test_internal_memory_single_mphf(Iterator keys, uint64_t num_keys) {
 
     internal_memory_builder_single_phf<murmurhash2_64> builder_64;
     internal_memory_builder_single_phf<murmurhash2_128> builder_128;
+    internal_memory_builder_single_phf<murmurhash2_64, fastrange_reducer> builder_fastrange_64;
+    internal_memory_builder_single_phf<murmurhash2_128, fastrange_reducer> builder_fastrange_128;
+    internal_memory_builder_single_phf<xxhash3_64> builder_xxhash3_64;
+    internal_memory_builder_single_phf<xxhash3_128> builder_xxhash3_128;
+    internal_memory_builder_single_phf<wyhash_64> builder_wyhash_64;
+    internal_memory_builder_single_phf<wyhash_128> builder_wyhash_128;
 
     build_configuration config;
     config.minimal_output = true;  // mphf
     config.verbose_output = false;
     config.seed = random_value();
 
+    thread_pool pool(4);
+
     std::vector<double> C{4.0, 4.5, 5.0, 5.5, 6.0};
     std::vector<double> A{1.0, 0.99, 0.98, 0.97, 0.96};
     for (auto c : C) {
@@ -36,6 +50,8 @@ void test_internal_memory_single_mphf(Iterator keys, uint64_t num_keys) {
             test_encoder<compact_compact>(builder_64, config, keys, num_keys);
             test_encoder<dictionary>(builder_64, config, keys, num_keys);
             test_encoder<dictionary_dictionary>(builder_64, config, keys, num_keys);
+            test_encoder<hashed_dictionary>(builder_64, config, keys, num_keys);
+            test_encoder<hashed_dictionary_dictionary>(builder_64, config, keys, num_keys);
             test_encoder<elias_fano>(builder_64, config, keys, num_keys);
             test_encoder<dictionary_elias_fano>(builder_64, config, keys, num_keys);
             test_encoder<sdc>(builder_64, config, keys, num_keys);
@@ -46,14 +62,109 @@ void test_internal_memory_single_mphf(Iterator keys, uint64_t num_keys) {
             test_encoder<compact_compact>(builder_128, config, keys, num_keys);
             test_encoder<dictionary>(builder_128, config, keys, num_keys);
             test_encoder<dictionary_dictionary>(builder_128, config, keys, num_keys);
+            test_encoder<hashed_dictionary>(builder_128, config, keys, num_keys);
+            test_encoder<hashed_dictionary_dictionary>(builder_128, config, keys, num_keys);
             test_encoder<elias_fano>(builder_128, config, keys, num_keys);
             test_encoder<dictionary_elias_fano>(builder_128, config, keys, num_keys);
             test_encoder<sdc>(builder_128, config, keys, num_keys);
+
+            builder_fastrange_64.build_from_keys(keys, num_keys, config);
+            test_encoder<dictionary_dictionary>(builder_fastrange_64, config, keys, num_keys);
+            test_encoder<elias_fano>(builder_fastrange_64, config, keys, num_keys);
+
+            builder_fastrange_128.build_from_keys(keys, num_keys, config);
+            test_encoder<dictionary_dictionary>(builder_fastrange_128, config, keys, num_keys);
+            test_encoder<elias_fano>(builder_fastrange_128, config, keys, num_keys);
+
+            builder_xxhash3_64.build_from_keys(keys, num_keys, config);
+            test_encoder<dictionary_dictionary>(builder_xxhash3_64, config, keys, num_keys);
+            test_encoder<elias_fano>(builder_xxhash3_64, config, keys, num_keys);
+
+            builder_xxhash3_128.build_from_keys(keys, num_keys, config);
+            test_encoder<dictionary_dictionary>(builder_xxhash3_128, config, keys, num_keys);
+            test_encoder<elias_fano>(builder_xxhash3_128, config, keys, num_keys);
+
+            builder_wyhash_64.build_from_keys(keys, num_keys, config);
+            test_encoder<dictionary_dictionary>(builder_wyhash_64, config, keys, num_keys);
+            test_encoder<elias_fano>(builder_wyhash_64, config, keys, num_keys);
+
+            builder_wyhash_128.build_from_keys(keys, num_keys, config);
+            test_encoder<dictionary_dictionary>(builder_wyhash_128, config, keys, num_keys);
+            test_encoder<elias_fano>(builder_wyhash_128, config, keys, num_keys);
+
+            config.counting_sort = true;
+            builder_64.build_from_keys(keys, num_keys, config);
+            test_encoder<dictionary_dictionary>(builder_64, config, keys, num_keys);
+            test_encoder<elias_fano>(builder_64, config, keys, num_keys);
+            config.counting_sort = false;
+
+            config.max_pilot = 20;  // bump some buckets
+            builder_64.build_from_keys(keys, num_keys, config);
+            test_encoder<dictionary_dictionary>(builder_64, config, keys, num_keys);
+            test_encoder<hashed_dictionary>(builder_64, config, keys, num_keys);
+            test_encoder<elias_fano>(builder_64, config, keys, num_keys);
+            builder_128.build_from_keys(keys, num_keys, config);
+            test_encoder<dictionary_dictionary>(builder_128, config, keys, num_keys);
+            test_encoder<hashed_dictionary>(builder_128, config, keys, num_keys);
+            config.max_pilot = constants::unlimited_pilot;
+
+            config.num_threads = 4;  // all the phases on the same threads
+            config.pool = &pool;
+            builder_64.build_from_keys(keys, num_keys, config);
+            test_encoder<dictionary_dictionary>(builder_64, config, keys, num_keys);
+            config.counting_sort = true;
+            builder_128.build_from_keys(keys, num_keys, config);
+            test_encoder<elias_fano>(builder_128, config, keys, num_keys);
+            config.counting_sort = false;
+            config.num_threads = 1;
+            config.pool = nullptr;
+        }
+    }
+}
+
+/* Many copies of a key make a bucket too large: counting sort must fail as sorting does. */
+void test_duplicate_keys() {
+    std::cout << "testing duplicate keys..." << std::endl;
+    std::vector<uint64_t> keys = distinct_keys<uint64_t>(10000, random_value());
+    keys.insert(keys.end(), 300, keys.front());
+    build_configuration config;
+    config.minimal_output = true;
+    config.verbose_output = false;
+    config.seed = random_value();
+    for (bool counting_sort : {false, true}) {
+        config.counting_sort = counting_sort;
+        internal_memory_builder_single_phf<murmurhash2_64> builder;
+        bool thrown = false;
+        try {
+            builder.build_from_keys(keys.begin(), keys.size(), config);
+        } catch (seed_runtime_error const&) {
+            thrown = true;
         }
+        testing::require_equal(thrown, true);
     }
 }
 
+/* max_pilot + 1 marks the bumped buckets: it must not wrap around to pilot 0. */
+void test_invalid_max_pilot() {
+    std::cout << "testing invalid max_pilot..." << std::endl;
+    std::vector<uint64_t> keys = distinct_keys<uint64_t>(10000, random_value());
+    build_configuration config;
+    config.minimal_output = true;
+    config.verbose_output = false;
+    config.max_pilot = uint64_t(-1);
+    internal_memory_builder_single_phf<murmurhash2_64> builder;
+    bool thrown = false;
+    try {
+        builder.build_from_keys(keys.begin(), keys.size(), config);
+    } catch (std::invalid_argument const&) {
+        thrown = true;
+    }
+    testing::require_equal(thrown, true);
+}
+
 int main() {
+    test_duplicate_keys();
+    test_invalid_max_pilot();
     static const uint64_t universe = 100000;
     for (int i = 0; i != 5; ++i) {
         uint64_t num_keys = random_value() % universe;
@@ -61,6 +172,14 @@ int main() {
         std::vector<uint64_t> keys = distinct_keys<uint64_t>(num_keys, random_value());
         assert(keys.size() == num_keys);
         test_internal_memory_single_mphf(keys.begin(), keys.size());
+
+        string_pool strings;
+        for (auto key : keys) {
+            std::string s = std::to_string(key);
+            uint8_t const* begin = reinterpret_cast<uint8_t const*>(s.data());
+            strings.push_back(begin, begin + s.size());
+        }
+        test_internal_memory_single_mphf(strings.begin(), strings.size());
     }
     return 0;
 }
@@ -0,0 +1,157 @@
+#include "common.hpp"
+
+using namespace pthash;
+
+static const std::string filename = "pthash.test_mapped_phf.bin";
+
+template <typename Function, typename View, typename Builder, typename Iterator>
+void test_view(Builder& builder, build_configuration const& config, Iterator keys,
+               uint64_t num_keys) {
+    Function f;
+    f.build(builder, config);
+    save_mapped(f, filename);
+    {
+        View view(filename);
+        testing::require_equal(view.num_keys(), f.num_keys());
+        testing::require_equal(view.table_size(), f.table_size());
+        testing::require_equal(view.seed(), f.seed());
+        for (uint64_t i = 0; i != num_keys; ++i) testing::require_equal(view(keys[i]), f(keys[i]));
+    }
+    std::remove(filename.c_str());
+}
+
+template <typename Hasher, typename Encoder, bool Minimal, typename RangeReducer,
+          typename SingleBuilder, typename PartitionedBuilder, typename Iterator>
+void test_views(SingleBuilder& single_builder, PartitionedBuilder& partitioned_builder,
+                build_configuration const& config, Iterator keys, uint64_t num_keys) {
+    test_view<single_phf<Hasher, Encoder, Minimal, RangeReducer>,
+              single_phf_view<Hasher, Encoder, Minimal, RangeReducer>>(single_builder, config,
+                                                                       keys, num_keys);
+    test_view<partitioned_phf<Hasher, Encoder, Minimal, RangeReducer>,
+              partitioned_phf_view<Hasher, Encoder, Minimal, RangeReducer>>(
+        partitioned_builder, config, keys, num_keys);
+}
+
+template <typename Hasher, typename RangeReducer, typename Iterator>
+void test_mapped_phf(Iterator keys, uint64_t num_keys) {
+    internal_memory_builder_single_phf<Hasher, RangeReducer> single_builder;
+    internal_memory_builder_partitioned_phf<Hasher, RangeReducer> partitioned_builder;
+
+    build_configuration config;
+    config.c = 5.0;
+    config.verbose_output = false;
+    config.seed = random_value();
+
+    std::vector<double> A{1.0, 0.99, 0.94};
+    for (auto alpha : A) {
+        config.alpha = alpha;
+        /* at full load, also test the bumped buckets */
+        config.max_pilot = alpha == 1.0 ? 20 : constants::unlimited_pilot;
+        for (bool minimal : {true, false}) {
+            config.minimal_output = minimal;
+            config.num_partitions = 1;
+            single_builder.build_from_keys(keys, num_keys, config);
+            config.num_partitions = 4;
+            partitioned_builder.build_from_keys(keys, num_keys, config);
+            if (minimal) {
+                test_views<Hasher, dictionary_dictionary, true, RangeReducer>(
+                    single_builder, partitioned_builder, config, keys, num_keys);
+                test_views<Hasher, elias_fano, true, RangeReducer>(
+                    single_builder, partitioned_builder, config, keys, num_keys);
+                test_views<Hasher, partitioned_compact, true, RangeReducer>(
+                    single_builder, partitioned_builder, config, keys, num_keys);
+                test_views<Hasher, sdc, true, RangeReducer>(single_builder, partitioned_builder,
+                                                            config, keys, num_keys);
+            } else {
+                test_views<Hasher, compact_compact, false, RangeReducer>(
+                    single_builder, partitioned_builder, config, keys, num_keys);
+                test_views<Hasher, hashed_dictionary_dictionary, false, RangeReducer>(
+                    single_builder, partitioned_builder, config, keys, num_keys);
+            }
+        }
+    }
+}
+
+void test_type_mismatch(std::vector<uint64_t> const& keys) {
+    build_configuration config;
+    config.c = 5.0;
+    config.alpha = 0.99;
+    config.minimal_output = true;
+    config.verbose_output = false;
+    single_phf<murmurhash2_64, dictionary_dictionary, true> f;
+    f.build_in_internal_memory(keys.begin(), keys.size(), config);
+    save_mapped(f, filename);
+    bool thrown = false;
+    try {
+        single_phf_view<murmurhash2_64, dictionary_dictionary, true, fastrange_reducer> view(
+            filename);
+    } catch (std::runtime_error const&) {
+        thrown = true;
+    }
+    testing::require_equal(thrown, true);
+    thrown = false;
+    try {
+        single_phf_view<murmurhash2_64, compact_compact, true> view(filename);
+    } catch (std::runtime_error const&) {
+        thrown = true;
+    }
+    testing::require_equal(thrown, true);
+
+    /* a file read with the other byte order */
+    std::fstream file(filename, std::ios::in | std::ios::out | std::ios::binary);
+    uint64_t magic = __builtin_bswap64(mapped::magic);
+    file.write(reinterpret_cast<char const*>(&magic), sizeof(magic));
+    file.close();
+    thrown = false;
+    try {
+        single_phf_view<murmurhash2_64, dictionary_dictionary, true> view(filename);
+    } catch (std::runtime_error const& e) {
+        thrown = std::string(e.what()).find("byte order") != std::string::npos;
+    }
+    std::remove(filename.c_str());
+    testing::require_equal(thrown, true);
+}
+
+void test_reseeded_partition() {
+    static const uint64_t num_keys = 100000;
+    static const uint64_t num_partitions = 4;
+    auto hashes = testing::hashes_with_overfull_bucket(num_keys, num_partitions, random_value());
+    build_configuration config;
+    config.minimal_output = true;
+    config.verbose_output = false;
+    config.seed = random_value();
+    config.num_partitions = num_partitions;
+    internal_memory_builder_partitioned_phf<murmurhash2_128> builder;
+    builder.build_from_hashes(hashes.begin(), num_keys, config);
+    partitioned_phf<murmurhash2_128, dictionary_dictionary, true> f;
+    f.build(builder, config);
+    save_mapped(f, filename);
+    {
+        partitioned_phf_view<murmurhash2_128, dictionary_dictionary, true> view(filename);
+        for (auto const& hash : hashes) {
+            testing::require_equal(view.position(hash), f.position(hash));
+        }
+    }
+    std::remove(filename.c_str());
+}
+
+int main() {
+    static const uint64_t universe = 100000;
+    for (int i = 0; i != 5; ++i) {
+        uint64_t num_keys = random_value() % universe;
+        if (num_keys < 4 * constants::min_partition_size) {
+            num_keys = 4 * constants::min_partition_size;
+        }
+        std::vector<uint64_t> keys = distinct_keys<uint64_t>(num_keys, random_value());
+        std::cout << "testing on " << num_keys << " keys..." << std::endl;
+        test_mapped_phf<murmurhash2_64, fastmod_reducer>(keys.begin(), keys.size());
+        test_mapped_phf<murmurhash2_128, fastmod_reducer>(keys.begin(), keys.size());
+        test_mapped_phf<murmurhash2_64, fastrange_reducer>(keys.begin(), keys.size());
+        test_mapped_phf<murmurhash2_128, fastrange_reducer>(keys.begin(), keys.size());
+        if (i == 0) {
+            test_type_mismatch(keys);
+            test_reseeded_partition();
+        }
+    }
+    return 0;
+}